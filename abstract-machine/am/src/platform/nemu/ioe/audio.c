@@ -8,19 +8,45 @@
 #define AUDIO_INIT_ADDR      (AUDIO_ADDR + 0x10)
 #define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
 
+// the offset in the stream buffer for the next bytes
+static uint32_t sbuf_pos = 0;
+static uint32_t sbuf_size = 0;
+
 void __am_audio_init() {
+  sbuf_size = inl(AUDIO_SBUF_SIZE_ADDR);
 }
 
 void __am_audio_config(AM_AUDIO_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->present = true;
+  cfg->bufsize = sbuf_size;
 }
 
 void __am_audio_ctrl(AM_AUDIO_CTRL_T *ctrl) {
+  outl(AUDIO_FREQ_ADDR, ctrl->freq);
+  outl(AUDIO_CHANNELS_ADDR, ctrl->channels);
+  outl(AUDIO_SAMPLES_ADDR, ctrl->samples);
+  outl(AUDIO_INIT_ADDR, 1);
 }
 
 void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
-  stat->count = 0;
+  stat->count = inl(AUDIO_COUNT_ADDR);
 }
 
 void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
+  const uint8_t *p = ctl->buf.start;
+  uint32_t len = (uint8_t *)ctl->buf.end - p;
+  while (len > 0) {
+    // wait until some bytes are played
+    uint32_t free = sbuf_size - inl(AUDIO_COUNT_ADDR);
+    if (free == 0) continue;
+    uint32_t n = (len < free ? len : free);
+    if (n > sbuf_size - sbuf_pos) n = sbuf_size - sbuf_pos;
+    volatile uint8_t *sbuf = (volatile uint8_t *)(uintptr_t)(AUDIO_SBUF_ADDR + sbuf_pos);
+    for (uint32_t i = 0; i < n; i ++) sbuf[i] = p[i];
+    sbuf_pos = (sbuf_pos + n) % sbuf_size;
+    // the device appends the bytes to the stream
+    outl(AUDIO_COUNT_ADDR, n);
+    p += n;
+    len -= n;
+  }
 }
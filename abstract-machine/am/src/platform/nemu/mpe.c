@@ -2,17 +2,42 @@
 #include <stdatomic.h>
 #include <klib-macros.h>
 
+// must match the stack layout in riscv/nemu/start.S
+#define MPE_STACK_SIZE (32 * 1024)
+
+int _mpe_ncpu = 1;
+int _mpe_ready = 0;
+uintptr_t _mpe_stack_top = 0;
+static void (*mpe_entry)() = NULL;
+
+void _mpe_start() {
+  mpe_entry();
+  panic("MPE entry returns");
+}
+
 bool mpe_init(void (*entry)()) {
+  int ncpu = cpu_count();
+  mpe_entry = entry;
+  // carve the stacks of the other cpus from the top of the heap
+  _mpe_stack_top = (uintptr_t)heap.end;
+  heap.end = (void *)((uintptr_t)heap.end - (ncpu - 1) * MPE_STACK_SIZE);
+  atomic_store_explicit(&_mpe_ready, 1, memory_order_release);
   entry();
   panic("MPE entry returns");
 }
 
 int cpu_count() {
-  return 1;
+  return atomic_load(&_mpe_ncpu);
 }
 
 int cpu_current() {
+#ifdef __riscv
+  uintptr_t id;
+  asm volatile("csrr %0, mhartid" : "=r"(id));
+  return id;
+#else
   return 0;
+#endif
 }
 
 int atomic_xchg(int *addr, int newval) {
@@ -0,0 +1,86 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_AOT_ABI_H__
+#define __CPU_AOT_ABI_H__
+
+/* The interface between NEMU and the C code generated by tools/aot from
+ * a riscv32 ELF image. The generated code is compiled separately into a
+ * shared object, so this header should not depend on any other header
+ * of NEMU. Bump AOT_ABI_VERSION on any change of the interface.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define AOT_ABI_VERSION 3
+#define AOT_PAGE_SHIFT 12
+
+// the same layout as the beginning of riscv32 CPU_state
+typedef struct {
+  uint32_t gpr[32];
+  uint32_t pc;
+} AOTState;
+
+typedef struct {
+  uint32_t (*read)(uint32_t addr, int len);
+  // return non-zero if the running block is dropped by the write
+  int (*write)(uint32_t addr, int len, uint32_t data);
+  uint8_t *pmem;
+  uint32_t mbase, msize;
+  const uint32_t *code_bitmap;  // one bit for each pmem page holding translated code
+  uint8_t *dirty;  // one flag for each pmem page written, NULL if not tracked
+} AOTHost;
+
+// run the block, update `s->pc' and return the number of instructions executed
+typedef int (*AOTFunc)(AOTState *s, const AOTHost *h);
+
+typedef struct {
+  uint32_t pc;
+  uint32_t nr_inst;
+  uint32_t hash;  // of the instructions, to reject a different image
+  AOTFunc func;
+} AOTBlock;
+
+// FNV-1a
+static inline uint32_t aot_hash(const uint32_t *inst, int n) {
+  uint32_t h = 2166136261u;
+  int i;
+  for (i = 0; i < n * 4; i ++) h = (h ^ ((const uint8_t *)inst)[i]) * 16777619u;
+  return h;
+}
+
+static inline uint32_t aot_read(const AOTHost *h, uint32_t addr, int len) {
+  uint32_t off = addr - h->mbase;
+  if (off <= h->msize - len) {
+    uint32_t data = 0;
+    memcpy(&data, h->pmem + off, len);
+    return data;
+  }
+  return h->read(addr, len);
+}
+
+static inline int aot_write(const AOTHost *h, uint32_t addr, int len, uint32_t data) {
+  uint32_t off = addr - h->mbase;
+  uint32_t page = off >> AOT_PAGE_SHIFT;
+  if (off <= h->msize - len && (addr & (len - 1)) == 0 && !((h->code_bitmap[page / 32] >> (page % 32)) & 1)) {
+    memcpy(h->pmem + off, &data, len);
+    if (h->dirty != NULL) h->dirty[page] = 1;
+    return 0;
+  }
+  return h->write(addr, len, data);
+}
+
+#endif
@@ -0,0 +1,30 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_AOT_H__
+#define __CPU_AOT_H__
+
+#include <common.h>
+
+#ifdef CONFIG_AOT
+void init_aot(const char *so_file);
+// run the block translated ahead of time at `cpu.pc' if it fits the budget `n',
+// return the number of instructions executed, or 0 if there is no such block
+int aot_exec(uint64_t n);
+void aot_flush_page(vaddr_t page);
+void aot_statistic();
+#endif
+
+#endif
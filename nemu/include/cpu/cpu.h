@@ -17,8 +17,17 @@
 #define __CPU_CPU_H__
 
 #include <common.h>
+#include <isa.h>
 
 void cpu_exec(uint64_t n);
+void init_harts();
+
+#ifdef CONFIG_MULTI_HART
+// the state of the running hart, which is `nemu_state' for hart 0
+extern HART_LOCAL NEMUState *hart_state;
+#else
+#define hart_state (&nemu_state)
+#endif
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret);
 void invalid_inst(vaddr_t thispc);
@@ -23,6 +23,7 @@ typedef struct Decode {
     vaddr_t snpc;  // static next pc
     vaddr_t dnpc;  // dynamic next pc
     ISADecodeInfo isa;
+    IFDEF(CONFIG_PREDECODE, const void *handler);  // cached execution body
     IFDEF(CONFIG_ITRACE, char logbuf[128]);
 } Decode;
 
@@ -101,6 +102,40 @@ finish:
 }
 
 // --- pattern matching wrappers for decode ---
+#ifdef CONFIG_DECODE_TREE
+// The index of the matched INSTPAT is looked up in the decode tree generated
+// by tools/gen-decode, and each INSTPAT becomes a case labeled with its order
+// of appearance in the table.
+#include <generated/decode-tree.h>
+
+#define INSTPAT_CHECK(pattern)                                         \
+    do {                                                               \
+        uint64_t key, mask, shift;                                     \
+        pattern_decode(pattern, STRLEN(pattern), &key, &mask, &shift); \
+        Assert((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key,   \
+               "decode tree is out of date with pattern \"%s\"",       \
+               pattern);                                               \
+    } while (0)
+
+#define INSTPAT(pattern, ...)                                \
+    case __COUNTER__ - __instpat_base - 1: {                 \
+        IFDEF(CONFIG_RT_CHECK, INSTPAT_CHECK(pattern));      \
+        INSTPAT_MATCH(s, ##__VA_ARGS__);                     \
+        goto *(__instpat_end);                               \
+    }
+
+#define INSTPAT_START(name)                                                   \
+    {                                                                         \
+        static const void *const __instpat_end = &&concat(__instpat_end_, name); \
+        enum { __instpat_base = __COUNTER__ };                                \
+        switch (decode_tree(INSTPAT_INST(s))) {
+#define INSTPAT_END(name)           \
+    default:                        \
+        break;                      \
+        }                           \
+    concat(__instpat_end_, name) :; \
+    }
+#else
 #define INSTPAT(pattern, ...)                                          \
     do {                                                               \
         uint64_t key, mask, shift;                                     \
@@ -113,9 +148,10 @@ finish:
 
 #define INSTPAT_START(name) \
     {                       \
-        const void *__instpat_end = &&concat(__instpat_end_, name);
+        static const void *const __instpat_end = &&concat(__instpat_end_, name);
 #define INSTPAT_END(name)           \
     concat(__instpat_end_, name) :; \
     }
+#endif
 
 #endif
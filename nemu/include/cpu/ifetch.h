@@ -14,13 +14,51 @@
 ***************************************************************************************/
 
 #ifndef __CPU_IFETCH_H__
+#define __CPU_IFETCH_H__
 
+#include <isa.h>
+#include <memory/host.h>
 #include <memory/vaddr.h>
 
+/* The host address of the page holding the last fetched instruction, so
+ * that the following fetches from the same page are plain loads. It is
+ * refilled by vaddr_ifetch(), and dropped with the software TLB. */
+typedef struct {
+  vaddr_t page;   // IFETCH_INVALID if the window is empty
+  uint8_t *host;
+} IFetchWindow;
+
+#define IFETCH_INVALID ((vaddr_t)1)
+
+extern HART_LOCAL IFetchWindow ifetch_window;
+
+static inline bool in_ifetch_window(vaddr_t pc) {
+  return (pc & ~PAGE_MASK) == ifetch_window.page;
+}
+
 static inline uint32_t inst_fetch(vaddr_t *pc, int len) {
-  uint32_t inst = vaddr_ifetch(*pc, len);
+  uint32_t inst;
+  if (likely(in_ifetch_window(*pc) && (*pc & PAGE_MASK) <= PAGE_SIZE - len)) {
+    inst = host_read(ifetch_window.host + (*pc & PAGE_MASK), len);
+  } else {
+    inst = vaddr_ifetch(*pc, len);
+  }
   (*pc) += len;
   return inst;
 }
 
+/* Copy at most `len' bytes of instructions from `pc' to `buf' without
+ * leaving the page of `pc'. Return the number of bytes copied, which is
+ * 0 if the page can not be fetched through the window. */
+static inline int inst_fetch_buf(vaddr_t pc, uint8_t *buf, int len) {
+  if (!in_ifetch_window(pc)) {
+    vaddr_ifetch(pc, 1);
+    if (!in_ifetch_window(pc)) return 0;
+  }
+  int off = pc & PAGE_MASK;
+  if (unlikely(len > PAGE_SIZE - off)) len = PAGE_SIZE - off;
+  memcpy(buf, ifetch_window.host + off, len);
+  return len;
+}
+
 #endif
@@ -0,0 +1,41 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_EVENT_H__
+#define __DEVICE_EVENT_H__
+
+#include <common.h>
+
+/* Device events are scheduled on the number of guest instructions
+ * executed. The CPU only compares the instruction count with
+ * `g_next_event', and calls `event_run()' when an event is due.
+ */
+
+#define EVENT_NEVER UINT64_MAX
+
+typedef void (*event_handler_t) ();
+
+int event_add(const char *name, event_handler_t h);
+// run the event after `delay' guest instructions, counted from the
+// instruction count seen by the CPU at the last check
+void event_schedule(int id, uint64_t delay);
+void event_cancel(int id);
+// async-signal-safe, run the event at the next check of the CPU
+void event_raise(int id);
+void event_run();
+
+extern volatile uint64_t g_next_event;
+
+#endif
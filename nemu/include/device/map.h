@@ -34,15 +34,28 @@ static inline bool map_inside(IOMap *map, paddr_t addr) {
   return (addr >= map->low && addr <= map->high);
 }
 
-static inline int find_mapid_by_addr(IOMap *maps, int size, paddr_t addr) {
+/* Maps never overlap, and each bus keeps an index of pointers to its
+ * maps sorted by address, so that an address is looked up by binary
+ * search. The maps themselves stay in the order they are added, since
+ * the lookup tables of the buses point to them. */
+
+// insert `map' into `index' holding `size' maps
+static inline void map_index_insert(IOMap **index, int size, IOMap *map) {
   int i;
-  for (i = 0; i < size; i ++) {
-    if (map_inside(maps + i, addr)) {
-      difftest_skip_ref();
-      return i;
-    }
+  for (i = size; i > 0 && index[i - 1]->low > map->low; i --) index[i] = index[i - 1];
+  index[i] = map;
+}
+
+// the map holding `addr', or NULL if there is none
+static inline IOMap* find_map_by_addr(IOMap **index, int size, paddr_t addr) {
+  int lo = 0, hi = size;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (addr < index[mid]->low) hi = mid;
+    else if (addr > index[mid]->high) lo = mid + 1;
+    else return index[mid];
   }
-  return -1;
+  return NULL;
 }
 
 void add_pio_map(const char *name, ioaddr_t addr,
@@ -50,7 +63,11 @@ void add_pio_map(const char *name, ioaddr_t addr,
 void add_mmio_map(const char *name, paddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
 
+/* `addr' should be inside `map', which is checked by the lookup of the
+ * bus, and the bus should call difftest_skip_ref() for the access */
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
+/* report an access to `addr', which is not inside any map of the bus */
+void map_out_of_bound(const char *bus, paddr_t addr);
 
 #endif
@@ -21,4 +21,10 @@
 word_t mmio_read(paddr_t addr, int len);
 void mmio_write(paddr_t addr, int len, word_t data);
 
+/* Set dirty[i] when the guest writes to the i-th page of the region
+ * holding `addr', counted from the page where the region begins. The
+ * flags are only set, and the device clears them when it consumes the
+ * changes. */
+void mmio_track_dirty(paddr_t addr, uint8_t *dirty);
+
 #endif
@@ -27,15 +27,25 @@ typedef concat(__GUEST_ISA__, _ISADecodeInfo) ISADecodeInfo;
 // monitor
 extern unsigned char isa_logo[];
 void init_isa();
+void init_isa_hart(int id);
 
 // reg
-extern CPU_state cpu;
+#ifdef CONFIG_MULTI_HART
+#define HART_LOCAL __thread  // each hart runs in its own host thread
+#else
+#define HART_LOCAL
+#endif
+extern HART_LOCAL CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
 
 // exec
 struct Decode;
 int isa_exec_once(struct Decode *s);
+// execute at most `n' pre-decoded instructions of a block starting from `s',
+// return the number of instructions executed
+int isa_exec_block(struct Decode *s, int n);
+void isa_fusion_statistic();
 
 // memory
 enum { MMU_DIRECT, MMU_TRANSLATE, MMU_FAIL };
@@ -101,6 +101,7 @@
 #define ROUNDDOWN(a, sz) ((((uintptr_t)a)) & ~((sz)-1))
 
 #define PG_ALIGN __attribute((aligned(4096)))
+#define HUGE_PG_ALIGN __attribute((aligned(2 * 1024 * 1024)))
 
 #if !defined(likely)
 #define likely(cond) __builtin_expect(cond, 1)
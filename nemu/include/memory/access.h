@@ -0,0 +1,105 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __MEMORY_ACCESS_H__
+#define __MEMORY_ACCESS_H__
+
+#include <isa.h>
+#include <memory/host.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+/* Guest loads and stores of a fixed width. The accesses to pmem without
+ * address translation are inlined into the caller, including the marking
+ * of dirty pages. Translated accesses, MMIO, and stores which may drop
+ * pre-decoded code take the slow path through vaddr_read()/vaddr_write(). */
+
+// return the host address of [addr, addr + len), or NULL for the slow path
+static inline uint8_t *guest_fast_host(vaddr_t addr, int len, int type) {
+  paddr_t off = (paddr_t)addr - CONFIG_MBASE;
+  if (isa_mmu_check(addr, len, type) != MMU_DIRECT || off > CONFIG_MSIZE - len) return NULL;
+#ifdef CONFIG_PREDECODE
+  if (type == MEM_TYPE_WRITE &&
+      ((addr & PAGE_MASK) > PAGE_SIZE - len || pmem_page_is_code(off >> PAGE_SHIFT))) return NULL;
+#endif
+#ifdef CONFIG_PMEM_SPARSE
+  // an unaligned access may cross two chunks
+  if ((off & (PMEM_CHUNK_SIZE - 1)) > PMEM_CHUNK_SIZE - len) return NULL;
+  return pmem_sparse_host(off);
+#else
+  return pmem + off;
+#endif
+}
+
+static inline void guest_mark_dirty(uint8_t *host, int len) {
+#ifdef CONFIG_PMEM_DIRTY
+  pmem_mark_dirty_host(host);
+  if (len > 1) pmem_mark_dirty_host(host + len - 1);
+#endif
+}
+
+static inline word_t vaddr_read8(vaddr_t addr) {
+  uint8_t *host = guest_fast_host(addr, 1, MEM_TYPE_READ);
+  return likely(host != NULL) ? host_read8(host) : vaddr_read(addr, 1);
+}
+
+static inline word_t vaddr_read16(vaddr_t addr) {
+  uint8_t *host = guest_fast_host(addr, 2, MEM_TYPE_READ);
+  return likely(host != NULL) ? host_read16(host) : vaddr_read(addr, 2);
+}
+
+static inline word_t vaddr_read32(vaddr_t addr) {
+  uint8_t *host = guest_fast_host(addr, 4, MEM_TYPE_READ);
+  return likely(host != NULL) ? host_read32(host) : vaddr_read(addr, 4);
+}
+
+static inline word_t vaddr_read8s(vaddr_t addr) { return (sword_t)(int8_t)vaddr_read8(addr); }
+static inline word_t vaddr_read16s(vaddr_t addr) { return (sword_t)(int16_t)vaddr_read16(addr); }
+
+static inline void vaddr_write8(vaddr_t addr, word_t data) {
+  uint8_t *host = guest_fast_host(addr, 1, MEM_TYPE_WRITE);
+  if (likely(host != NULL)) { host_write8(host, data); guest_mark_dirty(host, 1); }
+  else vaddr_write(addr, 1, data);
+}
+
+static inline void vaddr_write16(vaddr_t addr, word_t data) {
+  uint8_t *host = guest_fast_host(addr, 2, MEM_TYPE_WRITE);
+  if (likely(host != NULL)) { host_write16(host, data); guest_mark_dirty(host, 2); }
+  else vaddr_write(addr, 2, data);
+}
+
+static inline void vaddr_write32(vaddr_t addr, word_t data) {
+  uint8_t *host = guest_fast_host(addr, 4, MEM_TYPE_WRITE);
+  if (likely(host != NULL)) { host_write32(host, data); guest_mark_dirty(host, 4); }
+  else vaddr_write(addr, 4, data);
+}
+
+#ifdef CONFIG_ISA64
+static inline word_t vaddr_read32s(vaddr_t addr) { return (sword_t)(int32_t)vaddr_read32(addr); }
+
+static inline word_t vaddr_read64(vaddr_t addr) {
+  uint8_t *host = guest_fast_host(addr, 8, MEM_TYPE_READ);
+  return likely(host != NULL) ? host_read64(host) : vaddr_read(addr, 8);
+}
+
+static inline void vaddr_write64(vaddr_t addr, word_t data) {
+  uint8_t *host = guest_fast_host(addr, 8, MEM_TYPE_WRITE);
+  if (likely(host != NULL)) { host_write64(host, data); guest_mark_dirty(host, 8); }
+  else vaddr_write(addr, 8, data);
+}
+#endif
+
+#endif
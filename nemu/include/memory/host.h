@@ -18,6 +18,15 @@
 
 #include <common.h>
 
+#define HUGE_PAGE_SIZE (2ul * 1024 * 1024)
+
+/* allocate a host memory area holding guest memory or device space,
+ * aligned to and backed by huge pages with CONFIG_HOST_HUGEPAGE */
+void* host_alloc(size_t size, const char *name);
+#ifdef CONFIG_HOST_HUGEPAGE
+void host_advise_huge(void *addr, size_t size, const char *name);
+#endif
+
 static inline word_t host_read(void *addr, int len) {
   switch (len) {
     case 1: return *(uint8_t  *)addr;
@@ -38,4 +47,15 @@ static inline void host_write(void *addr, int len, word_t data) {
   }
 }
 
+// accesses of a fixed width, which also work for unaligned addresses
+static inline uint8_t  host_read8 (const void *addr) { return *(const uint8_t *)addr; }
+static inline uint16_t host_read16(const void *addr) { uint16_t x; memcpy(&x, addr, 2); return x; }
+static inline uint32_t host_read32(const void *addr) { uint32_t x; memcpy(&x, addr, 4); return x; }
+static inline uint64_t host_read64(const void *addr) { uint64_t x; memcpy(&x, addr, 8); return x; }
+
+static inline void host_write8 (void *addr, uint8_t  data) { *(uint8_t *)addr = data; }
+static inline void host_write16(void *addr, uint16_t data) { memcpy(addr, &data, 2); }
+static inline void host_write32(void *addr, uint32_t data) { memcpy(addr, &data, 4); }
+static inline void host_write64(void *addr, uint64_t data) { memcpy(addr, &data, 8); }
+
 #endif
@@ -17,6 +17,7 @@
 #define __MEMORY_PADDR_H__
 
 #include <common.h>
+#include <memory/vaddr.h>
 
 #define PMEM_LEFT  ((paddr_t)CONFIG_MBASE)
 #define PMEM_RIGHT ((paddr_t)CONFIG_MBASE + CONFIG_MSIZE - 1)
@@ -31,7 +32,93 @@ static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
+/* pmem itself, only for the inlined accesses in memory/access.h, use
+ * guest_to_host() elsewhere */
+#if   defined(CONFIG_PMEM_GARRAY)
+extern uint8_t pmem[];
+#elif defined(CONFIG_PMEM_SPARSE)
+/* Sparse pmem is a directory of tables, each of which maps 1 GiB of
+ * pmem to the host chunks of 2 MiB. Tables and chunks are allocated by
+ * guest_to_host() on the first access, and never freed. A chunk holds
+ * whole pages, so a host pointer is valid until the end of its page. */
+#define PMEM_CHUNK_SHIFT 21
+#define PMEM_TABLE_SHIFT 30
+#define PMEM_CHUNK_SIZE  (1ul << PMEM_CHUNK_SHIFT)
+#define PMEM_TABLE_LEN   (1 << (PMEM_TABLE_SHIFT - PMEM_CHUNK_SHIFT))
+#define PMEM_NR_TABLE    ((CONFIG_MSIZE + (1ul << PMEM_TABLE_SHIFT) - 1) >> PMEM_TABLE_SHIFT)
+
+extern uint8_t **pmem_dir[];
+
+// the host address at offset `off' of pmem, or NULL if its chunk is not allocated yet
+static inline uint8_t *pmem_sparse_host(paddr_t off) {
+  // chunks may be allocated by the host thread of another hart
+  uint8_t **table = __atomic_load_n(&pmem_dir[off >> PMEM_TABLE_SHIFT], __ATOMIC_ACQUIRE);
+  if (unlikely(table == NULL)) return NULL;
+  uint8_t *chunk = __atomic_load_n(&table[(off >> PMEM_CHUNK_SHIFT) & (PMEM_TABLE_LEN - 1)], __ATOMIC_ACQUIRE);
+  return likely(chunk != NULL) ? chunk + (off & (PMEM_CHUNK_SIZE - 1)) : NULL;
+}
+#else
+extern uint8_t *pmem;
+#endif
+
+/* the number of bytes from `addr', at most `len', which are contiguous
+ * in host memory from guest_to_host(addr) */
+static inline size_t paddr_host_span(paddr_t addr, size_t len) {
+#ifdef CONFIG_PMEM_SPARSE
+  size_t left = PMEM_CHUNK_SIZE - ((addr - CONFIG_MBASE) & (PMEM_CHUNK_SIZE - 1));
+  return len < left ? len : left;
+#else
+  return len;
+#endif
+}
+
+#ifdef CONFIG_PMEM_LAZY_RANDOM
+/* populate the pages of [addr, addr + len) before system calls write to
+ * them, since they are not populated by faults in the kernel */
+void paddr_touch(paddr_t addr, size_t len);
+#else
+static inline void paddr_touch(paddr_t addr, size_t len) {}
+#endif
+
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
+#ifdef CONFIG_PREDECODE
+/* record that the page of `addr' holds pre-decoded instructions,
+ * which are cached under the virtual address `vaddr' */
+void paddr_mark_code(paddr_t addr, vaddr_t vaddr);
+bool paddr_is_code(paddr_t addr);
+/* bitmap of pmem pages holding pre-decoded instructions, where bit
+ * (i % 32) of word (i / 32) is for page i = (addr - CONFIG_MBASE) >> PAGE_SHIFT */
+const uint32_t *paddr_code_bitmap();
+
+extern uint32_t pmem_code_bitmap[];
+// test the bit of the `idx'-th page of pmem
+static inline bool pmem_page_is_code(int idx) {
+  return (pmem_code_bitmap[idx / 32] >> (idx % 32)) & 1;
+}
+#endif
+
+#ifdef CONFIG_PMEM_DIRTY
+/* One flag for each page of pmem, set by the writes of the guest. A
+ * byte is used instead of a bit, so that a write marks its page with a
+ * plain store, which is also safe from the host threads of other harts. */
+extern uint8_t pmem_dirty[];
+
+static inline void pmem_mark_dirty(paddr_t addr) {
+  pmem_dirty[(addr - CONFIG_MBASE) >> PAGE_SHIFT] = 1;
+}
+
+static inline void pmem_mark_dirty_host(const uint8_t *host) {
+  pmem_dirty[(host - pmem) >> PAGE_SHIFT] = 1;
+}
+
+/* Move the flags into `bitmap', where bit (i % 64) of word (i / 64) is
+ * for page i = (addr - CONFIG_MBASE) >> PAGE_SHIFT, and return the number
+ * of dirty pages. `bitmap' holds at least PMEM_DIRTY_WORDS words. With
+ * multiple harts, this should be called when all harts are stopped. */
+#define PMEM_DIRTY_WORDS ((CONFIG_MSIZE / PAGE_SIZE + 63) / 64)
+int paddr_dirty_fetch_and_clear(uint64_t *bitmap);
+#endif
+
 #endif
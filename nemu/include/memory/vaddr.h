@@ -21,6 +21,25 @@
 word_t vaddr_ifetch(vaddr_t addr, int len);
 word_t vaddr_read(vaddr_t addr, int len);
 void vaddr_write(vaddr_t addr, int len, word_t data);
+/* return the host address of [addr, addr + len) for an access of `type',
+ * or NULL if it is outside pmem or crosses a page */
+uint8_t* vaddr_to_host(vaddr_t addr, int len, int type);
+#ifdef CONFIG_PREDECODE
+/* record that the page holding the instruction at `addr' holds
+ * pre-decoded instructions */
+void vaddr_mark_code(vaddr_t addr);
+/* stop caching writes to the physical page `page', which begins to
+ * hold pre-decoded instructions */
+void tlb_protect_code(paddr_t page);
+#endif
+
+/* The software TLB should be flushed when the page table changes. The
+ * instructions pre-decoded at the dropped virtual addresses are dropped
+ * as well. Switching the address space only keeps the translations of
+ * the other address spaces. */
+void tlb_flush();
+void tlb_flush_page(vaddr_t addr);
+void tlb_switch_asid(int asid);
 
 #define PAGE_SHIFT        12
 #define PAGE_SIZE         (1ul << PAGE_SHIFT)
@@ -33,6 +33,17 @@ extern NEMUState nemu_state;
 // ----------- timer -----------
 
 uint64_t get_time();
+// the time seen by the guest, which is driven by the number of
+// instructions executed in the icount mode, unit: us
+uint64_t get_guest_time();
+// 2^g_icount_shift ns per instruction in the icount mode, otherwise -1
+extern int g_icount_shift;
+
+// ----------- elf -----------
+
+// the name of the function containing `addr' in the symbol table of
+// the loaded ELF image, or NULL if it is not found
+const char* elf_func_name(vaddr_t addr);
 
 // ----------- log -----------
 
@@ -0,0 +1,128 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <dlfcn.h>
+#include <stddef.h>
+
+#include <isa.h>
+#include <cpu/aot.h>
+#include <cpu/aot-abi.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+#ifdef CONFIG_AOT
+
+typedef struct {
+  const AOTBlock *b;
+  bool valid;  // false if the guest has written to the block
+} AOTEntry;
+
+// open addressing hash table indexed by pc
+static AOTEntry *table = NULL;
+static uint32_t table_size = 0;
+static AOTHost host = {};
+static bool g_dropped = false;
+static uint64_t g_nr_aot_inst = 0, g_nr_drop = 0;
+
+static uint32_t aot_host_read(uint32_t addr, int len) {
+  return paddr_read(addr, len);
+}
+
+static int aot_host_write(uint32_t addr, int len, uint32_t data) {
+  g_dropped = false;
+  paddr_write(addr, len, data);
+  return g_dropped;
+}
+
+static AOTEntry *aot_lookup(vaddr_t pc) {
+  uint32_t i;
+  for (i = (pc / 4) & (table_size - 1); table[i].b != NULL; i = (i + 1) & (table_size - 1)) {
+    if (table[i].b->pc == pc) return &table[i];
+  }
+  return NULL;
+}
+
+void init_aot(const char *so_file) {
+  if (so_file == NULL) return;
+
+  void *handle = dlopen(so_file, RTLD_LAZY);
+  Assert(handle, "Can not open '%s': %s", so_file, dlerror());
+  const int *version = dlsym(handle, "aot_abi_version");
+  const int *nr_block = dlsym(handle, "aot_nr_block");
+  const AOTBlock *blocks = dlsym(handle, "aot_blocks");
+  Assert(version && nr_block && blocks, "'%s' is not generated by tools/aot", so_file);
+  Assert(*version == AOT_ABI_VERSION, "ABI version of '%s' is %d, but NEMU expects %d",
+      so_file, *version, AOT_ABI_VERSION);
+  Assert(offsetof(CPU_state, pc) == offsetof(AOTState, pc), "AOTState does not match CPU_state");
+
+  host = (AOTHost) {
+    .read = aot_host_read, .write = aot_host_write,
+    .pmem = guest_to_host(CONFIG_MBASE), .mbase = CONFIG_MBASE, .msize = CONFIG_MSIZE,
+    .code_bitmap = paddr_code_bitmap(),
+    .dirty = MUXDEF(CONFIG_PMEM_DIRTY, pmem_dirty, NULL),
+  };
+  for (table_size = 1; table_size < 2 * *nr_block; table_size *= 2);
+  table = calloc(table_size, sizeof(AOTEntry));
+
+  int i, nr_reject = 0;
+  for (i = 0; i < *nr_block; i ++) {
+    const AOTBlock *b = &blocks[i];
+    paddr_t end = b->pc + b->nr_inst * 4;
+    // reject blocks which do not match the loaded image
+    if (!in_pmem(b->pc) || !in_pmem(end - 1) ||
+        aot_hash((uint32_t *)guest_to_host(b->pc), b->nr_inst) != b->hash) {
+      nr_reject ++;
+      continue;
+    }
+    uint32_t j;
+    for (j = (b->pc / 4) & (table_size - 1); table[j].b != NULL; j = (j + 1) & (table_size - 1));
+    table[j] = (AOTEntry) { .b = b, .valid = true };
+    paddr_t page;
+    for (page = b->pc & ~PAGE_MASK; page < end; page += PAGE_SIZE) paddr_mark_code(page, page);
+  }
+  Log("AOT: %d blocks loaded from %s, %d rejected since they differ from the image",
+      *nr_block - nr_reject, so_file, nr_reject);
+}
+
+int aot_exec(uint64_t n) {
+  // blocks are translated from the physical image
+  if (table_size == 0 || isa_mmu_check(cpu.pc, 4, MEM_TYPE_IFETCH) == MMU_TRANSLATE) return 0;
+  AOTEntry *e = aot_lookup(cpu.pc);
+  if (e == NULL || !e->valid || e->b->nr_inst > n) return 0;
+  int nr = e->b->func((AOTState *)&cpu, &host);
+  g_nr_aot_inst += nr;
+  return nr;
+}
+
+/* Drop all blocks overlapping the page starting at `page'. This is
+ * called when the guest writes to a page holding translated code. */
+void aot_flush_page(vaddr_t page) {
+  uint32_t i;
+  for (i = 0; i < table_size; i ++) {
+    const AOTBlock *b = table[i].b;
+    if (b != NULL && table[i].valid && b->pc < page + PAGE_SIZE && b->pc + b->nr_inst * 4 > page) {
+      table[i].valid = false;
+      g_dropped = true;
+      g_nr_drop ++;
+    }
+  }
+}
+
+void aot_statistic() {
+  Log("instructions in AOT code = %" PRIu64 ", dropped AOT blocks = %" PRIu64,
+      g_nr_aot_inst, g_nr_drop);
+}
+
+#endif
@@ -13,10 +13,31 @@
  * See the Mulan PSL v2 for more details.
  ***************************************************************************************/
 
+#include <cpu/aot.h>
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
 #include <locale.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#ifdef CONFIG_ENGINE_THREADED
+#include <tcache.h>
+#endif
+#ifdef CONFIG_ENGINE_JIT
+#include <jit.h>
+#endif
+#ifdef CONFIG_DEVICE
+#include <device/event.h>
+#endif
+#ifdef CONFIG_VGA_CAPTURE
+#include <device/capture.h>
+#endif
+#ifdef CONFIG_HAS_AUDIO
+#include <device/audio.h>
+#endif
+#ifdef CONFIG_MULTI_HART
+#include <pthread.h>
+#endif
 
 /* The assembly code of instructions executed is only output to the screen
  * when the number of instructions executed is less than this value.
@@ -25,12 +46,74 @@
  */
 #define MAX_INST_TO_PRINT 10
 
-CPU_state cpu = {};
+/* Without tracing, difftest and watchpoints, instructions are executed in
+ * batches of at most this many instructions, and device events are only
+ * checked between batches. A batch also ends right before the next event
+ * is due, so this only bounds the delay of events raised by signals.
+ */
+#ifdef CONFIG_MULTI_HART
+// all harts are synchronized after each batch
+#define MAX_INST_PER_BATCH CONFIG_HART_QUANTUM
+#else
+#define MAX_INST_PER_BATCH 1024
+#endif
+
+HART_LOCAL CPU_state cpu = {};
 uint64_t g_nr_guest_inst = 0;
 static uint64_t g_timer = 0;  // unit: us
 static bool g_print_step = false;
 
-void device_update();
+bool has_watchpoint();
+bool check_watchpoints();
+
+#ifdef CONFIG_DECODE_CACHE
+#define DCACHE_SIZE CONFIG_DECODE_CACHE_SIZE
+#if (DCACHE_SIZE & (DCACHE_SIZE - 1)) != 0
+#error "CONFIG_DECODE_CACHE_SIZE should be a power of 2"
+#endif
+
+static Decode dcache[DCACHE_SIZE] = {};
+static uint64_t g_dcache_lookup = 0, g_dcache_miss = 0;
+
+static inline Decode *dcache_entry(vaddr_t pc) {
+    return &dcache[(pc / 4) & (DCACHE_SIZE - 1)];
+}
+
+// Return the entry for `pc'. On a miss the entry is reset, and
+// it will be filled by `isa_exec_once()' when decoding the instruction.
+static inline Decode *dcache_lookup(vaddr_t pc) {
+    Decode *s = dcache_entry(pc);
+    g_dcache_lookup++;
+    if (likely(s->pc == pc && s->handler != NULL)) {
+        return s;
+    }
+    g_dcache_miss++;
+    s->handler = NULL;
+    vaddr_mark_code(pc);
+    return s;
+}
+
+/* Drop all cached instructions inside the page starting at `page'.
+ * This is called when the guest writes to a page holding cached code. */
+void decode_cache_flush_page(vaddr_t page) {
+    vaddr_t pc;
+    for (pc = page; pc - page < PAGE_SIZE; pc += 4) {
+        Decode *s = dcache_entry(pc);
+        if (s->pc == pc) {
+            s->handler = NULL;
+        }
+    }
+}
+
+/* Drop all cached instructions. This is called when the mapping of
+ * virtual addresses changes. */
+void decode_cache_flush() {
+    int i;
+    for (i = 0; i < DCACHE_SIZE; i++) {
+        dcache[i].handler = NULL;
+    }
+}
+#endif
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #ifdef CONFIG_ITRACE_COND
@@ -42,6 +125,11 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
         IFDEF(CONFIG_ITRACE, puts(_this->logbuf));
     }
     IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
+#ifndef CONFIG_TARGET_AM
+    if (check_watchpoints() && nemu_state.state == NEMU_RUNNING) {
+        nemu_state.state = NEMU_STOP;
+    }
+#endif
 }
 
 static void exec_once(Decode *s, vaddr_t pc) {
@@ -78,15 +166,228 @@ static void exec_once(Decode *s, vaddr_t pc) {
 #endif
 }
 
+#ifdef CONFIG_ENGINE_THREADED
+/* Translate the block starting at `cpu.pc' by running it for the first
+ * time, which fills the execution bodies of its instructions. The block
+ * ends at a taken control transfer, a trap, a page boundary, or when the
+ * budget `n' is used up. Return the number of instructions executed. */
+static int translate_block(Decode *code, uint64_t n) {
+    vaddr_t page = cpu.pc & ~PAGE_MASK;
+    Decode *s = code;
+    int nr = 0;
+    bool cut = false;
+    while (true) {
+        s->handler = NULL;
+        exec_once(s, cpu.pc);
+        nr++;
+        // `code->handler' is dropped if the block modifies itself
+        if (s->dnpc != s->snpc || nemu_state.state != NEMU_RUNNING ||
+            code->handler == NULL || nr == TB_MAX_INST ||
+            (cpu.pc & ~PAGE_MASK) != page)
+            break;
+        if (nr == n) {
+            cut = true;
+            break;
+        }
+        s++;
+    }
+    tcache_end_block(code, nr);
+    // a block cut short by the budget is dropped, or it would stay short
+    if (cut)
+        code->handler = NULL;
+    return nr;
+}
+
+// run a block from `cpu.pc', return the number of instructions executed
+static int exec_block(uint64_t n) {
+    int nr = 0;
+#ifdef CONFIG_AOT
+    nr = aot_exec(n);
+    if (nr > 0)
+        return nr;
+#endif
+    TBlock *b = tcache_lookup(cpu.pc);
+    if (b == NULL)
+        return translate_block(tcache_new_block(cpu.pc), n);
+    // only run the host code when the whole block fits the budget
+    IFDEF(CONFIG_ENGINE_JIT, if (b->nr <= n) nr = jit_exec(b));
+    if (nr == 0) {
+        nr = isa_exec_block(b->code, n < TB_MAX_INST ? n : TB_MAX_INST);
+        cpu.pc = b->code[nr - 1].dnpc;
+    }
+    return nr;
+}
+
+// run at most `n' instructions, stop after a trap
+static uint64_t exec_batch(uint64_t n) {
+    uint64_t left = n;
+    while (left > 0) {
+        left -= exec_block(left);
+        if (nemu_state.state != NEMU_RUNNING)
+            break;
+    }
+    return n - left;
+}
+#else
+// run at most `n' instructions, stop after a trap
+static uint64_t exec_batch(uint64_t n) {
+    Decode s_buf, *s = &s_buf;
+    uint64_t left = n;
+    while (left > 0) {
+#ifdef CONFIG_AOT
+        int nr = aot_exec(left);
+        if (nr > 0) {
+            left -= nr;
+            if (hart_state->state != NEMU_RUNNING)
+                break;
+            continue;
+        }
+#endif
+        IFDEF(CONFIG_DECODE_CACHE, s = dcache_lookup(cpu.pc));
+#ifdef CONFIG_INST_FUSION
+        // a cached instruction may run together with the next one
+        if (s->handler != NULL) {
+            left -= isa_exec_block(s, left < 2 ? 1 : 2);
+            cpu.pc = s->dnpc;
+        } else
+#endif
+        {
+            exec_once(s, cpu.pc);
+            left--;
+        }
+        if (hart_state->state != NEMU_RUNNING)
+            break;
+    }
+    return n - left;
+}
+#endif
+
+#ifdef CONFIG_MULTI_HART
+/* Hart 0 runs in the thread calling cpu_exec(), and each of the other
+ * harts runs in its own host thread. In a quantum every hart executes
+ * the same budget as hart 0. Devices and the state of NEMU are only
+ * handled by hart 0 between quanta, when the other harts are waiting
+ * at the barrier. The instruction count of hart 0 drives the time.
+ *
+ * A trap of the other harts is recorded in their own `hart_halt[]',
+ * and folded into `nemu_state' by hart 0 at the end of the quantum.
+ * Once the program ends, the other harts skip the following quanta. A hart
+ * always runs its whole quantum, even if another hart traps in it. */
+HART_LOCAL NEMUState *hart_state = &nemu_state;
+static NEMUState hart_halt[CONFIG_NR_HART] = {};
+static bool harts_stop = false;
+static pthread_barrier_t quantum_start, quantum_end;
+static uint64_t quantum_budget = 0;
+static uint64_t hart_nr_inst[CONFIG_NR_HART] = {};
+
+static void *hart_main(void *arg) {
+    int id = (intptr_t)arg;
+    init_isa_hart(id);
+    hart_state = &hart_halt[id];
+    while (true) {
+        pthread_barrier_wait(&quantum_start);
+        if (!__atomic_load_n(&harts_stop, __ATOMIC_ACQUIRE))
+            hart_nr_inst[id] += exec_batch(quantum_budget);
+        pthread_barrier_wait(&quantum_end);
+    }
+    return NULL;
+}
+
+static void harts_start(uint64_t n) {
+    quantum_budget = n;
+    pthread_barrier_wait(&quantum_start);
+}
+
+static void harts_wait() {
+    pthread_barrier_wait(&quantum_end);
+    int i;
+    for (i = 1; i < CONFIG_NR_HART; i++) {
+        if (hart_halt[i].state != NEMU_RUNNING &&
+            nemu_state.state == NEMU_RUNNING)
+            nemu_state = hart_halt[i];
+    }
+    // NEMU_STOP can be resumed, the other states end the program
+    if (nemu_state.state != NEMU_RUNNING && nemu_state.state != NEMU_STOP)
+        __atomic_store_n(&harts_stop, true, __ATOMIC_RELEASE);
+}
+
+// let all harts run again, they are waiting at the barrier
+static void harts_resume() {
+    int i;
+    for (i = 1; i < CONFIG_NR_HART; i++) {
+        hart_halt[i].state = NEMU_RUNNING;
+    }
+    __atomic_store_n(&harts_stop, false, __ATOMIC_RELEASE);
+}
+
+void init_harts() {
+    pthread_barrier_init(&quantum_start, NULL, CONFIG_NR_HART);
+    pthread_barrier_init(&quantum_end, NULL, CONFIG_NR_HART);
+    int i;
+    for (i = 1; i < CONFIG_NR_HART; i++) {
+        pthread_t t;
+        int ret = pthread_create(&t, NULL, hart_main, (void *)(intptr_t)i);
+        Assert(ret == 0, "Can not create the thread of hart %d", i);
+        pthread_detach(t);
+    }
+    Log("Running %d harts, quantum = %d instructions", CONFIG_NR_HART,
+        CONFIG_HART_QUANTUM);
+}
+#endif
+
+/* Run at most `n' instructions one at a time with all the bookkeeping,
+ * which is required by tracing, difftest and watchpoints. The code
+ * caches of the threaded engine and AOT are bypassed. The instruction
+ * count is advanced here to keep the trace window exact, except with
+ * multiple harts, which may read it in the quantum. */
+static uint64_t exec_slow(uint64_t n) {
+    Decode s_buf, *s = &s_buf;
+    uint64_t left = n;
+    while (left > 0) {
+#ifdef CONFIG_DECODE_CACHE
+        s = dcache_lookup(cpu.pc);
+#else
+        IFDEF(CONFIG_PREDECODE, s->handler = NULL);
+#endif
+        exec_once(s, cpu.pc);
+        left--;
+        IFNDEF(CONFIG_MULTI_HART, g_nr_guest_inst++);
+        trace_and_difftest(s, cpu.pc);
+        if (nemu_state.state != NEMU_RUNNING)
+            break;
+    }
+    return n - left;
+}
+
 static void execute(uint64_t n) {
-    Decode s;
-    for (; n > 0; n--) {
-        exec_once(&s, cpu.pc);
-        g_nr_guest_inst++;
-        trace_and_difftest(&s, cpu.pc);
+#if defined(CONFIG_ITRACE) || defined(CONFIG_DIFFTEST)
+    bool slow = true;
+#else
+    bool slow = MUXDEF(CONFIG_TARGET_AM, false, has_watchpoint());
+#endif
+    // the slow path runs in batches too, so that the other
+    // harts keep running in quanta when hart 0 is traced
+    while (n > 0) {
+        uint64_t budget = n < MAX_INST_PER_BATCH ? n : MAX_INST_PER_BATCH;
+#ifdef CONFIG_DEVICE
+        uint64_t next = g_next_event;
+        if (next <= g_nr_guest_inst) {
+            event_run();
+            if (nemu_state.state != NEMU_RUNNING)
+                break;
+            continue;
+        }
+        if (next - g_nr_guest_inst < budget)
+            budget = next - g_nr_guest_inst;
+#endif
+        IFDEF(CONFIG_MULTI_HART, harts_start(budget));
+        uint64_t nr = slow ? exec_slow(budget) : exec_batch(budget);
+        IFDEF(CONFIG_MULTI_HART, harts_wait());
+        if (!slow || ISDEF(CONFIG_MULTI_HART))
+            g_nr_guest_inst += nr;
+        n -= nr;
         if (nemu_state.state != NEMU_RUNNING)
             break;
-        IFDEF(CONFIG_DEVICE, device_update());
     }
 }
 
@@ -101,6 +402,29 @@ static void statistic() {
     else
         Log("Finish running in less than 1 us and can not calculate the "
             "simulation frequency");
+#ifdef CONFIG_DECODE_CACHE
+    // instructions run by other engines or fused into their
+    // predecessor never look up the cache, so count the lookups
+    if (g_dcache_lookup > 0) {
+        uint64_t hit = g_dcache_lookup - g_dcache_miss;
+        uint64_t rate = hit * 10000 / g_dcache_lookup;  // unit: 0.01%
+        Log("decode cache hit rate = %d.%02d%% (" NUMBERIC_FMT
+            " hits, " NUMBERIC_FMT " misses)",
+            (int)(rate / 100), (int)(rate % 100), hit, g_dcache_miss);
+    }
+#endif
+#ifdef CONFIG_MULTI_HART
+    int i;
+    for (i = 1; i < CONFIG_NR_HART; i++) {
+        Log("guest instructions of hart %d = " NUMBERIC_FMT, i,
+            hart_nr_inst[i]);
+    }
+#endif
+    IFDEF(CONFIG_INST_FUSION, isa_fusion_statistic());
+    IFDEF(CONFIG_ENGINE_THREADED, tcache_statistic());
+    IFDEF(CONFIG_AOT, aot_statistic());
+    IFDEF(CONFIG_VGA_CAPTURE, capture_statistic());
+    IFDEF(CONFIG_HAS_AUDIO, audio_statistic());
 }
 
 void assert_fail_msg() {
@@ -121,6 +445,7 @@ void cpu_exec(uint64_t n) {
             return;
         default:
             nemu_state.state = NEMU_RUNNING;
+            IFDEF(CONFIG_MULTI_HART, harts_resume());
     }
 
     uint64_t timer_start = get_time();
@@ -87,7 +87,13 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
       "If it is not necessary, you can turn it off in menuconfig.", ref_so_file);
 
   ref_difftest_init(port);
-  ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
+  paddr_t addr = RESET_VECTOR;
+  while (img_size > 0) {
+    size_t n = paddr_host_span(addr, img_size);
+    ref_difftest_memcpy(addr, guest_to_host(addr), n, DIFFTEST_TO_REF);
+    addr += n;
+    img_size -= n;
+  }
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
 }
 
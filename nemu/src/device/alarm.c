@@ -15,6 +15,7 @@
 
 #include <common.h>
 #include <device/alarm.h>
+#include <device/event.h>
 #include <sys/time.h>
 #include <signal.h>
 
@@ -22,20 +23,38 @@
 
 static alarm_handler_t handler[MAX_HANDLER] = {};
 static int idx = 0;
+static int alarm_event = -1;
+static uint64_t icount_interval = 0;
 
 void add_alarm_handle(alarm_handler_t h) {
   assert(idx < MAX_HANDLER);
   handler[idx ++] = h;
 }
 
-static void alarm_sig_handler(int signum) {
+static void alarm_run() {
+  if (g_icount_shift >= 0) event_schedule(alarm_event, icount_interval);
   int i;
   for (i = 0; i < idx; i ++) {
     handler[i]();
   }
 }
 
+// the handlers are called by the CPU through the event queue,
+// instead of running inside the signal handler
+static void alarm_sig_handler(int signum) {
+  event_raise(alarm_event);
+}
+
 void init_alarm() {
+  alarm_event = event_add("alarm", alarm_run);
+
+  if (g_icount_shift >= 0) {
+    // fire on the virtual time instead of the host CPU time
+    icount_interval = (1000000000ull / TIMER_HZ) >> g_icount_shift;
+    event_schedule(alarm_event, icount_interval);
+    return;
+  }
+
   struct sigaction s;
   memset(&s, 0, sizeof(s));
   s.sa_handler = alarm_sig_handler;
@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #include <common.h>
+#include <device/audio.h>
 #include <device/map.h>
 #include <SDL2/SDL.h>
 
@@ -30,12 +31,84 @@ enum {
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
 
+/* The stream buffer is a ring of CONFIG_SB_SIZE bytes. The guest fills
+ * the free space, then writes the number of new bytes to reg_count to
+ * advance `sb_head', and reading reg_count gives the number of bytes not
+ * played yet. The SDL audio callback is the only consumer and advances
+ * `sb_tail'. Each index is only written by one thread, so neither side
+ * takes a lock. The indices wrap around 2^32, which is a multiple of the
+ * size of the ring.
+ */
+static uint32_t sb_head = 0;  // by the CPU thread
+static uint32_t sb_tail = 0;  // by the audio callback
+static bool audio_opened = false;
+static bool stream_active = false;  // by the audio callback
+static uint64_t nr_underrun = 0, nr_played = 0;
+
+static void audio_callback(void *userdata, uint8_t *stream, int len) {
+  uint32_t tail = sb_tail;
+  uint32_t used = __atomic_load_n(&sb_head, __ATOMIC_ACQUIRE) - tail;
+  uint32_t n = (used < len ? used : len);
+  uint32_t off = tail % CONFIG_SB_SIZE;
+  uint32_t n1 = (n < CONFIG_SB_SIZE - off ? n : CONFIG_SB_SIZE - off);
+  memcpy(stream, sbuf + off, n1);
+  memcpy(stream + n1, sbuf, n - n1);
+  if (n < len) {
+    memset(stream + n, 0, len - n);
+    // count a gap in the stream once
+    if (stream_active) __atomic_add_fetch(&nr_underrun, 1, __ATOMIC_RELAXED);
+  }
+  stream_active = (n == len);
+  __atomic_add_fetch(&nr_played, n, __ATOMIC_RELAXED);
+  __atomic_store_n(&sb_tail, tail + n, __ATOMIC_RELEASE);
+}
+
+static void open_audio() {
+  SDL_AudioSpec s = {};
+  s.freq = audio_base[reg_freq];
+  s.format = AUDIO_S16SYS;
+  s.channels = audio_base[reg_channels];
+  s.samples = audio_base[reg_samples];
+  s.callback = audio_callback;
+  s.userdata = NULL;
+  audio_opened = (SDL_InitSubSystem(SDL_INIT_AUDIO) == 0 && SDL_OpenAudio(&s, NULL) == 0);
+  if (!audio_opened) {
+    // the stream is dropped, so the guest does not wait for space forever
+    Log("Can not open audio, the stream is discarded");
+    return;
+  }
+  SDL_PauseAudio(0);
+}
+
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
+  switch (offset / sizeof(uint32_t)) {
+    case reg_init:
+      if (is_write && !audio_opened) open_audio();
+      break;
+    case reg_count:
+      if (is_write) {
+        uint32_t n = audio_base[reg_count];
+        Assert(sb_head - __atomic_load_n(&sb_tail, __ATOMIC_ACQUIRE) + n <= CONFIG_SB_SIZE,
+            "audio stream buffer overflow");
+        __atomic_store_n(&sb_head, sb_head + n, __ATOMIC_RELEASE);
+        if (!audio_opened) __atomic_store_n(&sb_tail, sb_head, __ATOMIC_RELEASE);
+      }
+      audio_base[reg_count] = sb_head - __atomic_load_n(&sb_tail, __ATOMIC_ACQUIRE);
+      break;
+    default: break;
+  }
+}
+
+void audio_statistic() {
+  Log("audio bytes played = %" PRIu64 ", underruns = %" PRIu64,
+      __atomic_load_n(&nr_played, __ATOMIC_RELAXED), __atomic_load_n(&nr_underrun, __ATOMIC_RELAXED));
 }
 
 void init_audio() {
+  Assert((CONFIG_SB_SIZE & (CONFIG_SB_SIZE - 1)) == 0, "the size of the stream buffer should be a power of 2");
   uint32_t space_size = sizeof(uint32_t) * nr_reg;
   audio_base = (uint32_t *)new_space(space_size);
+  audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
 #ifdef CONFIG_HAS_PORT_IO
   add_pio_map ("audio", CONFIG_AUDIO_CTL_PORT, audio_base, space_size, audio_io_handler);
 #else
@@ -0,0 +1,157 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/alarm.h>
+#include <device/capture.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+/* Frames synced by the guest are copied into a ring of slots, and the
+ * writer thread encodes them into CONFIG_VGA_CAPTURE_FILE. The CPU thread
+ * is the only producer and the writer is the only consumer, so the ring
+ * only needs the two indices. A frame is dropped if all slots are full.
+ */
+#define NR_SLOT CONFIG_VGA_CAPTURE_SLOTS
+
+static uint32_t *slot[NR_SLOT] = {};
+static uint64_t head = 0;  // written by the CPU thread
+static uint64_t tail = 0;  // written by the writer, slots [tail, head) hold frames
+static sem_t nr_frame;
+
+static int width = 0, height = 0;
+static FILE *fp = NULL;
+static uint8_t *out = NULL;  // the encoded frame
+#ifdef CONFIG_VGA_CAPTURE_DEDUP
+static uint32_t *last_frame = NULL;  // the frame written last
+#endif
+static pthread_t writer;
+
+static uint64_t nr_captured = 0, nr_dropped = 0;  // by the CPU thread
+static uint64_t nr_written = 0, nr_dup = 0;       // by the writer
+
+static void encode_frame(const uint32_t *frame) {
+  int i, n = width * height;
+#ifdef CONFIG_VGA_CAPTURE_Y4M
+  // BT.601 in studio range, one plane after another
+  uint8_t *y = out, *u = out + n, *v = out + 2 * n;
+  for (i = 0; i < n; i ++) {
+    int r = (frame[i] >> 16) & 0xff, g = (frame[i] >> 8) & 0xff, b = frame[i] & 0xff;
+    y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+  }
+  fputs("FRAME\n", fp);
+#else
+  for (i = 0; i < n; i ++) {
+    out[3 * i + 0] = frame[i] >> 16;
+    out[3 * i + 1] = frame[i] >> 8;
+    out[3 * i + 2] = frame[i];
+  }
+  fprintf(fp, "P6\n%d %d\n255\n", width, height);
+#endif
+  fwrite(out, 3, n, fp);
+}
+
+#ifdef CONFIG_VGA_CAPTURE_DEDUP
+// FNV-1a over 64-bit words
+static uint64_t frame_hash(const uint32_t *frame) {
+  int i, n = width * height / 2;
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (i = 0; i < n; i ++) {
+    uint64_t w;
+    memcpy(&w, &frame[i * 2], sizeof(w));
+    h = (h ^ w) * 0x100000001b3ull;
+  }
+  if ((width * height) % 2) h = (h ^ frame[width * height - 1]) * 0x100000001b3ull;
+  return h;
+}
+#endif
+
+static void* writer_thread(void *arg) {
+  IFDEF(CONFIG_VGA_CAPTURE_DEDUP, uint64_t last_hash = 0);
+  while (true) {
+    sem_wait(&nr_frame);
+    uint64_t t = tail;
+    // an extra post with an empty ring stops the writer
+    if (t == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) break;
+    const uint32_t *frame = slot[t % NR_SLOT];
+    bool dup = false;
+#ifdef CONFIG_VGA_CAPTURE_DEDUP
+    // the hash only filters, a collision must not drop a changed frame
+    uint64_t hash = frame_hash(frame);
+    dup = (nr_written > 0 && hash == last_hash &&
+        memcmp(frame, last_frame, width * height * sizeof(uint32_t)) == 0);
+    last_hash = hash;
+    if (!dup) memcpy(last_frame, frame, width * height * sizeof(uint32_t));
+#endif
+    if (dup) nr_dup ++;
+    else { encode_frame(frame); nr_written ++; }
+    __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+  }
+  fflush(fp);
+  return NULL;
+}
+
+void capture_frame(const uint32_t *pixels) {
+  if (fp == NULL) return;  // the writer is stopped
+  uint64_t h = head;
+  if (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) == NR_SLOT) { nr_dropped ++; return; }
+  memcpy(slot[h % NR_SLOT], pixels, width * height * sizeof(uint32_t));
+  __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+  nr_captured ++;
+  sem_post(&nr_frame);
+}
+
+// let the writer drain the ring and stop, when the statistics are
+// reported or NEMU exits, whichever comes first
+static void fini_capture() {
+  if (fp == NULL) return;
+  sem_post(&nr_frame);
+  pthread_join(writer, NULL);
+  fclose(fp);
+  fp = NULL;
+}
+
+void capture_statistic() {
+  fini_capture();
+  Log("captured frames = %" PRIu64 ", dropped frames = %" PRIu64, nr_captured, nr_dropped);
+  Log("written frames = %" PRIu64 ", duplicated frames = %" PRIu64, nr_written, nr_dup);
+}
+
+void init_capture(int w, int h) {
+  width = w;
+  height = h;
+  int i;
+  for (i = 0; i < NR_SLOT; i ++) {
+    slot[i] = malloc(w * h * sizeof(uint32_t));
+    assert(slot[i]);
+  }
+  out = malloc(w * h * 3);
+  assert(out);
+#ifdef CONFIG_VGA_CAPTURE_DEDUP
+  last_frame = malloc(w * h * sizeof(uint32_t));
+  assert(last_frame);
+#endif
+
+  // a pipe blocks here until it is opened by the reader
+  fp = fopen(CONFIG_VGA_CAPTURE_FILE, "wb");
+  Assert(fp, "Can not open '%s'", CONFIG_VGA_CAPTURE_FILE);
+  IFDEF(CONFIG_VGA_CAPTURE_Y4M, fprintf(fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", w, h, TIMER_HZ));
+
+  sem_init(&nr_frame, 0, 0);
+  pthread_create(&writer, NULL, writer_thread, NULL);
+  atexit(fini_capture);
+  Log("Capture frames to %s", CONFIG_VGA_CAPTURE_FILE);
+}
@@ -16,6 +16,7 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
+#include <device/event.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
@@ -33,9 +34,45 @@ void init_alarm();
 void send_key(uint8_t, bool);
 void vga_update_screen();
 
-void device_update() {
+// check the time every this many guest instructions
+#define DEVICE_UPDATE_INTERVAL 65536
+
+#ifdef CONFIG_VGA_SCREEN_THREAD
+/* SDL events are polled by the screen thread in vga.c, and handled by
+ * the CPU thread. The queue has a single producer and a single consumer,
+ * so it only needs the two indices. */
+#define EVENT_QUEUE_LEN 256
+static SDL_Event event_queue[EVENT_QUEUE_LEN];
+static uint32_t event_head = 0, event_tail = 0;
+
+void device_post_event(const SDL_Event *event) {
+  if (event->type != SDL_QUIT && event->type != SDL_KEYDOWN && event->type != SDL_KEYUP) return;
+  uint32_t head = event_head;
+  // drop the event if the CPU thread is too far behind
+  if (head - __atomic_load_n(&event_tail, __ATOMIC_ACQUIRE) == EVENT_QUEUE_LEN) return;
+  event_queue[head % EVENT_QUEUE_LEN] = *event;
+  __atomic_store_n(&event_head, head + 1, __ATOMIC_RELEASE);
+}
+
+static int poll_event(SDL_Event *event) {
+  uint32_t tail = event_tail;
+  if (tail == __atomic_load_n(&event_head, __ATOMIC_ACQUIRE)) return 0;
+  *event = event_queue[tail % EVENT_QUEUE_LEN];
+  __atomic_store_n(&event_tail, tail + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+#elif !defined(CONFIG_TARGET_AM)
+#define poll_event SDL_PollEvent
+#endif
+
+static int update_event = -1;
+
+static void device_update() {
+  event_schedule(update_event, DEVICE_UPDATE_INTERVAL);
+
+  // the guest time in the icount mode, so that the screen only depends on the guest
   static uint64_t last = 0;
-  uint64_t now = get_time();
+  uint64_t now = get_guest_time();
   if (now - last < 1000000 / TIMER_HZ) {
     return;
   }
@@ -45,7 +82,7 @@ void device_update() {
 
 #ifndef CONFIG_TARGET_AM
   SDL_Event event;
-  while (SDL_PollEvent(&event)) {
+  while (poll_event(&event)) {
     switch (event.type) {
       case SDL_QUIT:
         nemu_state.state = NEMU_QUIT;
@@ -69,7 +106,7 @@ void device_update() {
 void sdl_clear_event_queue() {
 #ifndef CONFIG_TARGET_AM
   SDL_Event event;
-  while (SDL_PollEvent(&event));
+  while (poll_event(&event));
 #endif
 }
 
@@ -77,6 +114,9 @@ void init_device() {
   IFDEF(CONFIG_TARGET_AM, ioe_init());
   init_map();
 
+  update_event = event_add("update", device_update);
+  event_schedule(update_event, DEVICE_UPDATE_INTERVAL);
+
   IFDEF(CONFIG_HAS_SERIAL, init_serial());
   IFDEF(CONFIG_HAS_TIMER, init_timer());
   IFDEF(CONFIG_HAS_VGA, init_vga());
@@ -0,0 +1,139 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <device/event.h>
+#include <signal.h>
+
+#define MAX_EVENT 16
+
+typedef struct {
+  const char *name;
+  event_handler_t handler;
+  uint64_t when;
+  int heap_idx;  // -1 if not scheduled
+  volatile sig_atomic_t raised;
+} Event;
+
+static Event events[MAX_EVENT] = {};
+static int nr_event = 0;
+// a binary min-heap of the scheduled events ordered by `when'
+static int heap[MAX_EVENT] = {};
+static int nr_heap = 0;
+
+volatile uint64_t g_next_event = EVENT_NEVER;
+extern uint64_t g_nr_guest_inst;
+
+static inline bool heap_less(int i, int j) {
+  return events[heap[i]].when < events[heap[j]].when;
+}
+
+static inline void heap_swap(int i, int j) {
+  int t = heap[i];
+  heap[i] = heap[j];
+  heap[j] = t;
+  events[heap[i]].heap_idx = i;
+  events[heap[j]].heap_idx = j;
+}
+
+static void heap_up(int i) {
+  while (i > 0 && heap_less(i, (i - 1) / 2)) {
+    heap_swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void heap_down(int i) {
+  while (true) {
+    int min = i, l = 2 * i + 1, r = 2 * i + 2;
+    if (l < nr_heap && heap_less(l, min)) min = l;
+    if (r < nr_heap && heap_less(r, min)) min = r;
+    if (min == i) return;
+    heap_swap(i, min);
+    i = min;
+  }
+}
+
+static void heap_remove(int id) {
+  int i = events[id].heap_idx;
+  nr_heap --;
+  if (i != nr_heap) {
+    heap_swap(i, nr_heap);
+    heap_up(i);
+    heap_down(i);
+  }
+  events[id].heap_idx = -1;
+}
+
+static void update_next_event() {
+  g_next_event = (nr_heap > 0 ? events[heap[0]].when : EVENT_NEVER);
+  // an event raised by a signal handler before the update above
+  // should not be missed
+  int i;
+  for (i = 0; i < nr_event; i ++) {
+    if (events[i].raised) { g_next_event = 0; break; }
+  }
+}
+
+int event_add(const char *name, event_handler_t h) {
+  Assert(nr_event < MAX_EVENT, "too many events");
+  Event *e = &events[nr_event];
+  e->name = name;
+  e->handler = h;
+  e->heap_idx = -1;
+  e->raised = 0;
+  return nr_event ++;
+}
+
+void event_schedule(int id, uint64_t delay) {
+  assert(id >= 0 && id < nr_event);
+  Assert(delay > 0, "event '%s' should be scheduled in the future", events[id].name);
+  Event *e = &events[id];
+  if (e->heap_idx >= 0) heap_remove(id);
+  e->when = g_nr_guest_inst + delay;
+  e->heap_idx = nr_heap;
+  heap[nr_heap ++] = id;
+  heap_up(e->heap_idx);
+  update_next_event();
+}
+
+void event_cancel(int id) {
+  assert(id >= 0 && id < nr_event);
+  if (events[id].heap_idx >= 0) {
+    heap_remove(id);
+    update_next_event();
+  }
+}
+
+void event_raise(int id) {
+  events[id].raised = 1;
+  g_next_event = 0;
+}
+
+void event_run() {
+  int i;
+  for (i = 0; i < nr_event; i ++) {
+    if (events[i].raised) {
+      events[i].raised = 0;
+      events[i].handler();
+    }
+  }
+  while (nr_heap > 0 && events[heap[0]].when <= g_nr_guest_inst) {
+    int id = heap[0];
+    heap_remove(id);
+    events[id].handler();
+  }
+  update_next_event();
+}
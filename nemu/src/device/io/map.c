@@ -17,6 +17,12 @@
 #include <memory/host.h>
 #include <memory/vaddr.h>
 #include <device/map.h>
+#ifdef CONFIG_MULTI_HART
+#include <pthread.h>
+
+// devices are not thread-safe, serialize the accesses from all harts
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 #define IO_SPACE_MAX (32 * 1024 * 1024)
 
@@ -32,14 +38,8 @@ uint8_t* new_space(int size) {
   return p;
 }
 
-static void check_bound(IOMap *map, paddr_t addr) {
-  if (map == NULL) {
-    Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
-  } else {
-    Assert(addr <= map->high && addr >= map->low,
-        "address (" FMT_PADDR ") is out of bound {%s} [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
-        addr, map->name, map->low, map->high, cpu.pc);
-  }
+void map_out_of_bound(const char *bus, paddr_t addr) {
+  panic("%s address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, bus, addr, cpu.pc);
 }
 
 static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_write) {
@@ -47,24 +47,25 @@ static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_wr
 }
 
 void init_map() {
-  io_space = malloc(IO_SPACE_MAX);
-  assert(io_space);
+  io_space = host_alloc(IO_SPACE_MAX, "io space");
   p_space = io_space;
 }
 
 word_t map_read(paddr_t addr, int len, IOMap *map) {
-  assert(len >= 1 && len <= 8);
-  check_bound(map, addr);
+  IFDEF(CONFIG_RT_CHECK, assert(len >= 1 && len <= 8 && map_inside(map, addr)));
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_MULTI_HART, pthread_mutex_lock(&map_lock));
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
+  IFDEF(CONFIG_MULTI_HART, pthread_mutex_unlock(&map_lock));
   return ret;
 }
 
 void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
-  assert(len >= 1 && len <= 8);
-  check_bound(map, addr);
+  IFDEF(CONFIG_RT_CHECK, assert(len >= 1 && len <= 8 && map_inside(map, addr)));
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_MULTI_HART, pthread_mutex_lock(&map_lock));
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
+  IFDEF(CONFIG_MULTI_HART, pthread_mutex_unlock(&map_lock));
 }
@@ -14,16 +14,74 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 
 #define NR_MAP 16
 
 static IOMap maps[NR_MAP] = {};
+static IOMap *map_index[NR_MAP] = {};
 static int nr_map = 0;
 
-static IOMap* fetch_mmio_map(paddr_t addr) {
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  return (mapid == -1 ? NULL : &maps[mapid]);
+/* Accesses to MMIO space are dispatched by physical page with a sparse
+ * two-level table built by add_mmio_map(). A page overlapped by only one
+ * region goes to that region directly, and a page wholly inside a region
+ * without callback is accessed through its host address. Other pages,
+ * i.e. pages shared by several regions or not mapped at all, fall back
+ * to the binary search of `map_index'.
+ */
+#define MMIO_DIR_SHIFT 22
+#define NR_MMIO_DIR (1 << (32 - MMIO_DIR_SHIFT))
+#define NR_MMIO_PAGE (1 << (MMIO_DIR_SHIFT - PAGE_SHIFT))
+
+typedef struct {
+  uint8_t *host;  // host address of a RAM-like page, or NULL
+  IOMap *map;     // the only region overlapping the page, or NULL
+  uint8_t *dirty; // flag set by the writes to the page, or NULL
+} MMIOPage;
+
+static MMIOPage *mmio_dir[NR_MMIO_DIR] = {};
+
+static inline MMIOPage* mmio_page(paddr_t addr) {
+  if ((uint64_t)addr >> MMIO_DIR_SHIFT >= NR_MMIO_DIR) return NULL;
+  MMIOPage *dir = mmio_dir[addr >> MMIO_DIR_SHIFT];
+  return (dir == NULL ? NULL : &dir[(addr >> PAGE_SHIFT) & (NR_MMIO_PAGE - 1)]);
+}
+
+static void update_mmio_page(paddr_t page) {
+  if ((uint64_t)page >> MMIO_DIR_SHIFT >= NR_MMIO_DIR) return;
+  MMIOPage **dir = &mmio_dir[page >> MMIO_DIR_SHIFT];
+  if (*dir == NULL) {
+    *dir = calloc(NR_MMIO_PAGE, sizeof(MMIOPage));
+    assert(*dir);
+  }
+  MMIOPage *pg = mmio_page(page);
+  paddr_t last = page + PAGE_SIZE - 1;
+  int i, nr_overlap = 0;
+  *pg = (MMIOPage) { .dirty = pg->dirty };
+  for (i = 0; i < nr_map; i ++) {
+    if (page <= maps[i].high && last >= maps[i].low) {
+      nr_overlap ++;
+      pg->map = &maps[i];
+    }
+  }
+  if (nr_overlap != 1) { pg->map = NULL; return; }
+#ifndef CONFIG_DIFFTEST
+  // the REF should skip accesses to devices, so they should not bypass map_read()
+  IOMap *map = pg->map;
+  if (map->callback == NULL && map->low <= page && map->high >= last) {
+    pg->host = (uint8_t *)map->space + (page - map->low);
+  }
+#endif
+}
+
+// the region holding `addr' in the page `pg', which may be NULL
+static inline IOMap* fetch_mmio_map(MMIOPage *pg, paddr_t addr) {
+  IOMap *map = (pg != NULL && pg->map != NULL ? pg->map : find_map_by_addr(map_index, nr_map, addr));
+  // the only region of a page may not cover the whole page
+  if (unlikely(map == NULL || !map_inside(map, addr))) map_out_of_bound("mmio", addr);
+  return map;
 }
 
 static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
@@ -50,14 +108,46 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
   Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
       maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
 
+  map_index_insert(map_index, nr_map, &maps[nr_map]);
   nr_map ++;
+
+  uint64_t page;
+  for (page = left & ~PAGE_MASK; page <= right; page += PAGE_SIZE) update_mmio_page(page);
+}
+
+void mmio_track_dirty(paddr_t addr, uint8_t *dirty) {
+  IOMap *map = find_map_by_addr(map_index, nr_map, addr);
+  assert(map != NULL);
+  paddr_t first = map->low & ~PAGE_MASK;
+  uint64_t page;
+  for (page = first; page <= map->high; page += PAGE_SIZE) {
+    MMIOPage *pg = mmio_page(page);
+    if (pg != NULL) pg->dirty = &dirty[(page - first) >> PAGE_SHIFT];
+  }
 }
 
 /* bus interface */
 word_t mmio_read(paddr_t addr, int len) {
-  return map_read(addr, len, fetch_mmio_map(addr));
+  MMIOPage *pg = mmio_page(addr);
+  if (pg != NULL && pg->host != NULL) return host_read(pg->host + (addr & PAGE_MASK), len);
+  IOMap *map = fetch_mmio_map(pg, addr);
+  difftest_skip_ref();
+  return map_read(addr, len, map);
+}
+
+static void mark_dirty(MMIOPage *pg, paddr_t addr, int len) {
+  *pg->dirty = 1;
+  if (unlikely((addr & PAGE_MASK) + len > PAGE_SIZE)) {
+    MMIOPage *next = mmio_page(addr + len - 1);
+    if (next != NULL && next->dirty != NULL) *next->dirty = 1;
+  }
 }
 
 void mmio_write(paddr_t addr, int len, word_t data) {
-  map_write(addr, len, data, fetch_mmio_map(addr));
+  MMIOPage *pg = mmio_page(addr);
+  if (pg != NULL && pg->dirty != NULL) mark_dirty(pg, addr, len);
+  if (pg != NULL && pg->host != NULL) { host_write(pg->host + (addr & PAGE_MASK), len, data); return; }
+  IOMap *map = fetch_mmio_map(pg, addr);
+  difftest_skip_ref();
+  map_write(addr, len, data, map);
 }
@@ -21,29 +21,44 @@
 static IOMap maps[NR_MAP] = {};
 static int nr_map = 0;
 
+// the map of each port plus one, or 0 if the port is not mapped
+static uint8_t port_map[PORT_IO_SPACE_MAX] = {};
+
+// the map containing the whole access [addr, addr + len)
+static inline IOMap* fetch_pio_map(ioaddr_t addr, int len) {
+  int id = (addr < PORT_IO_SPACE_MAX ? port_map[addr] : 0);
+  if (unlikely(id == 0 || addr + len - 1 > maps[id - 1].high)) map_out_of_bound("port-io", addr);
+  return &maps[id - 1];
+}
+
 /* device interface */
 void add_pio_map(const char *name, ioaddr_t addr, void *space, uint32_t len, io_callback_t callback) {
   assert(nr_map < NR_MAP);
-  assert(addr + len <= PORT_IO_SPACE_MAX);
+  Assert(addr + len <= PORT_IO_SPACE_MAX, "port-io map '%s' at [%d, %d) is out of bound",
+      name, addr, addr + len);
   maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
     .space = space, .callback = callback };
   Log("Add port-io map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
       maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
 
+  uint32_t i;
+  for (i = addr; i < addr + len; i ++) {
+    Assert(port_map[i] == 0, "port-io map '%s' is overlapped with '%s' at port %d",
+        name, maps[port_map[i] - 1].name, i);
+    port_map[i] = nr_map + 1;
+  }
   nr_map ++;
 }
 
 /* CPU interface */
 uint32_t pio_read(ioaddr_t addr, int len) {
-  assert(addr + len - 1 < PORT_IO_SPACE_MAX);
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  assert(mapid != -1);
-  return map_read(addr, len, &maps[mapid]);
+  IOMap *map = fetch_pio_map(addr, len);
+  difftest_skip_ref();
+  return map_read(addr, len, map);
 }
 
 void pio_write(ioaddr_t addr, int len, uint32_t data) {
-  assert(addr + len - 1 < PORT_IO_SPACE_MAX);
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  assert(mapid != -1);
-  map_write(addr, len, data, &maps[mapid]);
+  IOMap *map = fetch_pio_map(addr, len);
+  difftest_skip_ref();
+  map_write(addr, len, data, map);
 }
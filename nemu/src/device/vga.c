@@ -15,6 +15,9 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <device/mmio.h>
+#include <device/capture.h>
+#include <memory/vaddr.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -35,13 +38,36 @@ static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
 #ifdef CONFIG_VGA_SHOW_SCREEN
+/* One flag for each page of vmem, set by the writes of the guest. Only
+ * the scanlines overlapped by the dirty pages are drawn to the screen. */
+static uint8_t *vmem_dirty = NULL;
+static int nr_vmem_page = 0;
+
+// call `draw' for each run of dirty scanlines, return whether there is any
+static bool draw_dirty(void (*draw)(int y, int h)) {
+  uint32_t pitch = screen_width() * sizeof(uint32_t);
+  bool drawn = false;
+  int i = 0, j;
+  while (i < nr_vmem_page) {
+    if (!vmem_dirty[i]) { i ++; continue; }
+    for (j = i; j < nr_vmem_page && vmem_dirty[j]; j ++) vmem_dirty[j] = 0;
+    int y0 = (uint64_t)i * PAGE_SIZE / pitch;
+    int y1 = ((uint64_t)j * PAGE_SIZE + pitch - 1) / pitch;
+    if (y1 > screen_height()) y1 = screen_height();
+    draw(y0, y1 - y0);
+    drawn = true;
+    i = j;
+  }
+  return drawn;
+}
+
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
 
-static void init_screen() {
+static void open_screen() {
   SDL_Window *window = NULL;
   char title[128];
   sprintf(title, "%s-NEMU", str(__GUEST_ISA__));
@@ -56,24 +82,141 @@ static void init_screen() {
   SDL_RenderPresent(renderer);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+static void upload_lines(const uint32_t *pixels, int y, int h) {
+  SDL_Rect rect = { .x = 0, .y = y, .w = SCREEN_W, .h = h };
+  SDL_UpdateTexture(texture, &rect, pixels + y * SCREEN_W, SCREEN_W * sizeof(uint32_t));
+}
+
+static void present() {
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
 }
+
+#ifdef CONFIG_VGA_SCREEN_THREAD
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+/* The screen thread owns SDL. On sync, the CPU thread copies the dirty
+ * scanlines of vmem into one of two frames, and publishes it in `pending'
+ * with the scanlines changed since the frame taken last by the screen
+ * thread, which are the only ones uploaded. The screen thread takes the
+ * frame by swapping `pending' with -1, and holds it until it takes the
+ * next one. So the CPU thread rewrites the published frame if it is not
+ * taken yet, and writes the other frame otherwise.
+ */
+static uint32_t *frame[2] = {};
+// the changed scanlines [y0, y1) of each frame
+static int frame_y0[2] = {}, frame_y1[2] = {};
+static int pending = -1;  // the frame published and not taken yet, or -1
+static int last = 1;      // the frame published last, only for the CPU thread
+static sem_t frame_sem, ready_sem;
+static int dirty_y0 = 0, dirty_y1 = 0;
+static pthread_t screen_tid;
+static bool screen_stop = false;
+
+void device_post_event(const SDL_Event *event);
+
+static void* screen_thread(void *arg) {
+  open_screen();
+  sem_post(&ready_sem);
+  while (!__atomic_load_n(&screen_stop, __ATOMIC_ACQUIRE)) {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) device_post_event(&event);
+    int b = __atomic_exchange_n(&pending, -1, __ATOMIC_ACQUIRE);
+    if (b != -1) {
+      upload_lines(frame[b], frame_y0[b], frame_y1[b] - frame_y0[b]);
+      present();
+      continue;
+    }
+    // wait for the next frame, but keep polling the events
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 10 * 1000 * 1000;
+    if (ts.tv_nsec >= 1000 * 1000 * 1000) { ts.tv_sec ++; ts.tv_nsec -= 1000 * 1000 * 1000; }
+    sem_timedwait(&frame_sem, &ts);
+  }
+  SDL_Quit();
+  return NULL;
+}
+
+// stop the screen thread before NEMU exits, since it owns SDL
+static void fini_screen() {
+  __atomic_store_n(&screen_stop, true, __ATOMIC_RELEASE);
+  sem_post(&frame_sem);
+  pthread_join(screen_tid, NULL);
+}
+
+static void init_screen() {
+  int i;
+  for (i = 0; i < 2; i ++) {
+    frame[i] = calloc(1, screen_size());
+    assert(frame[i]);
+  }
+  sem_init(&frame_sem, 0, 0);
+  sem_init(&ready_sem, 0, 0);
+  pthread_create(&screen_tid, NULL, screen_thread, NULL);
+  // let SDL be initialized by one thread at a time
+  sem_wait(&ready_sem);
+  atexit(fini_screen);
+}
+
+static void grow_dirty(int y, int h) {
+  if (y < dirty_y0) dirty_y0 = y;
+  if (y + h > dirty_y1) dirty_y1 = y + h;
+}
+
+static inline void update_screen() {
+  dirty_y0 = SCREEN_H, dirty_y1 = 0;
+  if (!draw_dirty(grow_dirty)) return;
+  int p = __atomic_exchange_n(&pending, -1, __ATOMIC_ACQUIRE);
+  int b = (p == -1 ? 1 - last : last);
+  if (p != -1) {
+    // the screen thread has not seen the changes in the replaced frame,
+    // so they are uploaded with this one, and the scanlines between the
+    // two ranges are copied as well
+    if (frame_y0[b] < dirty_y0) dirty_y0 = frame_y0[b];
+    if (frame_y1[b] > dirty_y1) dirty_y1 = frame_y1[b];
+  }
+  memcpy(frame[b] + dirty_y0 * SCREEN_W, (uint32_t *)vmem + dirty_y0 * SCREEN_W,
+      (dirty_y1 - dirty_y0) * SCREEN_W * sizeof(uint32_t));
+  frame_y0[b] = dirty_y0;
+  frame_y1[b] = dirty_y1;
+  __atomic_store_n(&pending, b, __ATOMIC_RELEASE);
+  last = b;
+  sem_post(&frame_sem);
+}
+#else
+static void init_screen() { open_screen(); }
+
+static void draw_lines(int y, int h) { upload_lines(vmem, y, h); }
+
+static inline void update_screen() {
+  // nothing to present if the guest did not draw
+  if (draw_dirty(draw_lines)) present();
+}
+#endif
 #else
 static void init_screen() {}
 
+static void draw_lines(int y, int h) {
+  io_write(AM_GPU_FBDRAW, 0, y, (uint32_t *)vmem + y * screen_width(), screen_width(), h, false);
+}
+
 static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+  if (draw_dirty(draw_lines)) io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
 }
 #endif
 #endif
 
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  // the guest writes the sync register when a frame is finished
+  if (vgactl_port_base[1] != 0) {
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, update_screen());
+    IFDEF(CONFIG_VGA_CAPTURE, capture_frame(vmem));
+    vgactl_port_base[1] = 0;
+  }
 }
 
 void init_vga() {
@@ -87,6 +230,15 @@ void init_vga() {
 
   vmem = new_space(screen_size());
   add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
+  IFDEF(CONFIG_VGA_CAPTURE, init_capture(screen_width(), screen_height()));
   IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
   IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+#ifdef CONFIG_VGA_SHOW_SCREEN
+  nr_vmem_page = (screen_size() + PAGE_SIZE - 1) / PAGE_SIZE;
+  vmem_dirty = malloc(nr_vmem_page);
+  assert(vmem_dirty);
+  // the first frame draws the whole screen
+  memset(vmem_dirty, 1, nr_vmem_page);
+  mmio_track_dirty(CONFIG_FB_ADDR, vmem_dirty);
+#endif
 }
@@ -15,3 +15,6 @@
 
 INC_PATH += $(NEMU_HOME)/src/engine/$(ENGINE)
 DIRS-y += src/engine/$(ENGINE)
+
+# the threaded engine shares the monitor loop and host calls with the interpreter
+SRCS-$(CONFIG_ENGINE_THREADED) += src/engine/interpreter/init.c src/engine/interpreter/hostcall.c
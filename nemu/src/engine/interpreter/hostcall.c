@@ -17,12 +17,13 @@
 #include <cpu/ifetch.h>
 #include <isa.h>
 #include <cpu/difftest.h>
+#include <cpu/cpu.h>
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret) {
   difftest_skip_ref();
-  nemu_state.state = state;
-  nemu_state.halt_pc = pc;
-  nemu_state.halt_ret = halt_ret;
+  hart_state->state = state;
+  hart_state->halt_pc = pc;
+  hart_state->halt_ret = halt_ret;
 }
 
 __attribute__((noinline))
@@ -0,0 +1,570 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* A simple x86-64 backend for the threaded engine. A hot block is
+ * compiled into a host function `int f(CPU_state *cpu)' which returns
+ * the number of instructions executed and updates `cpu->pc'. The most
+ * used guest registers of the block are kept in callee-saved host
+ * registers, and the others are accessed in `cpu->gpr' through r15.
+ * Each instruction computes its result in eax with operands in eax and
+ * ecx, which keeps the code generator small.
+ *
+ * Loads and stores inside pmem are inlined. Other accesses call
+ * paddr_read()/paddr_write(), and so do stores to code pages, which
+ * leave the block if it is dropped by the store.
+ */
+
+#include <isa.h>
+#include <memory/host.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include "jit.h"
+
+#ifdef CONFIG_ENGINE_JIT
+
+#ifndef __x86_64__
+#error "the JIT backend only supports x86-64 hosts"
+#endif
+
+#define ARENA_SIZE (16 * 1024 * 1024)
+// an upper bound of the host code size of a block
+#define MAX_BLOCK_CODE (TB_MAX_INST * 160 + 256)
+#define MAX_EXIT (TB_MAX_INST * 2 + 2)
+#define NR_HOST_REG 5
+
+#define PC_OFF offsetof(CPU_state, pc)
+#define GPR_OFF(r) (offsetof(CPU_state, gpr) + (r) * sizeof(word_t))
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xc, CC_GE = 0xd };
+
+// callee-saved host registers to hold guest registers
+static const int alloc_reg[NR_HOST_REG] = { RBX, RBP, R12, R13, R14 };
+static int host_reg[32];  // -1 if the guest register is in memory
+
+static uint8_t *arena = NULL;
+static uint8_t *p = NULL;  // where to emit the next byte
+static uint8_t *exits[MAX_EXIT];
+static int nr_exit = 0;
+static TBlock *cur_block = NULL;
+static uint64_t g_nr_compile = 0, g_nr_native = 0;
+
+// --- x86-64 encoder ---
+
+static inline void emit8(uint8_t x) { *p ++ = x; }
+static inline void emit32(uint32_t x) { memcpy(p, &x, 4); p += 4; }
+static inline void emit64(uint64_t x) { memcpy(p, &x, 8); p += 8; }
+
+static inline void modrm(int mod, int reg, int rm) {
+  emit8((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* `op' holds an optional legacy prefix in bits 23-16, an optional
+ * escape byte in bits 15-8 and the opcode in bits 7-0. The REX prefix
+ * is only emitted when needed, so 8-bit operands must be al or cl. */
+static void emit_op(int w, uint32_t op, int reg, int index, int base) {
+  uint8_t rex = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+  if (op >> 16) emit8(op >> 16);
+  if (rex != 0x40) emit8(rex);
+  if ((op >> 8) & 0xff) emit8(op >> 8);
+  emit8(op);
+}
+
+// op reg, rm
+static void x_rr(int w, uint32_t op, int reg, int rm) {
+  emit_op(w, op, reg, 0, rm);
+  modrm(3, reg, rm);
+}
+
+// op reg, [base + disp32], `base' should not be rsp or r12
+static void x_rm(uint32_t op, int reg, int base, int32_t disp) {
+  emit_op(0, op, reg, 0, base);
+  modrm(2, reg, base);
+  emit32(disp);
+}
+
+// op reg, [base + index], `base' should not be rbp or r13
+__attribute__((unused))
+static void x_rsib(uint32_t op, int reg, int base, int index) {
+  emit_op(0, op, reg, index, base);
+  modrm(0, reg, 4);
+  emit8(((index & 7) << 3) | (base & 7));
+}
+
+// op rm, imm32 with opcode extension `ext', e.g. add = 0, cmp = 7
+static void x_ri(int ext, int rm, uint32_t imm) {
+  emit_op(0, 0x81, 0, 0, rm);
+  modrm(3, ext, rm);
+  emit32(imm);
+}
+
+// shl = 4, shr = 5, sar = 7
+static void x_shift_i(int w, int ext, int rm, int imm) {
+  emit_op(w, 0xc1, 0, 0, rm);
+  modrm(3, ext, rm);
+  emit8(imm);
+}
+
+static void x_shift_cl(int ext, int rm) {
+  emit_op(0, 0xd3, 0, 0, rm);
+  modrm(3, ext, rm);
+}
+
+static void x_mov_ri(int reg, uint32_t imm) {
+  emit_op(0, 0xb8 + (reg & 7), 0, 0, reg);
+  emit32(imm);
+}
+
+static void x_mov_ri64(int reg, uint64_t imm) {
+  emit_op(1, 0xb8 + (reg & 7), 0, 0, reg);
+  emit64(imm);
+}
+
+// eax = (eax `cc' operand) after a cmp
+static void x_setcc(int cc) {
+  x_rr(0, 0x0f90 | cc, 0, RAX);
+  x_rr(0, 0x0fb6, RAX, RAX);
+}
+
+static void x_push(int reg) { emit_op(0, 0x50 + (reg & 7), 0, 0, reg); }
+static void x_pop(int reg) { emit_op(0, 0x58 + (reg & 7), 0, 0, reg); }
+
+static void x_call(const void *f) {
+  x_mov_ri64(RAX, (uintptr_t)f);
+  emit8(0xff); emit8(0xd0);  // call rax
+}
+
+// return the end of the rel32 field, which is patched by `patch()'
+static uint8_t *x_jcc(int cc) { emit8(0x0f); emit8(0x80 | cc); emit32(0); return p; }
+static uint8_t *x_jmp() { emit8(0xe9); emit32(0); return p; }
+
+static void patch(uint8_t *rel_end, uint8_t *target) {
+  int32_t rel = target - rel_end;
+  memcpy(rel_end - 4, &rel, 4);
+}
+
+// --- helpers called by host code ---
+
+#ifdef CONFIG_JIT_VERIFY
+typedef struct {
+  paddr_t addr;
+  int len;
+  word_t old;
+} StoreLog;
+
+static StoreLog store_log[TB_MAX_INST];
+static int nr_store = 0;
+static bool touch_device = false;
+static uint64_t g_nr_verify = 0;
+#endif
+
+static word_t jit_load(paddr_t addr, int len) {
+  IFDEF(CONFIG_JIT_VERIFY, if (!in_pmem(addr)) touch_device = true);
+  return paddr_read(addr, len);
+}
+
+// return true if the running block is dropped by the store
+static int jit_store(paddr_t addr, int len, word_t data) {
+#ifdef CONFIG_JIT_VERIFY
+  if (in_pmem(addr)) {
+    StoreLog *l = &store_log[nr_store ++];
+    l->addr = addr;
+    l->len = len;
+    l->old = host_read(guest_to_host(addr), len);
+  } else touch_device = true;
+#endif
+  paddr_write(addr, len, data);
+  return cur_block->code->handler == NULL;
+}
+
+static word_t jit_div(word_t a, word_t b, int funct3) {
+  int32_t sa = a, sb = b;
+  switch (funct3) {
+    case 4: return b == 0 ? -1 : ((sa == INT32_MIN && sb == -1) ? INT32_MIN : sa / sb);
+    case 5: return b == 0 ? UINT32_MAX : a / b;
+    case 6: return b == 0 ? a : ((sa == INT32_MIN && sb == -1) ? 0 : sa % sb);
+    default: return b == 0 ? a : a % b;
+  }
+}
+
+// --- code generator ---
+
+static void load_gpr(int reg, int r) {
+  if (r == 0) x_rr(0, 0x31, reg, reg);  // xor
+  else if (host_reg[r] >= 0) x_rr(0, 0x89, host_reg[r], reg);
+  else x_rm(0x8b, reg, R15, GPR_OFF(r));
+}
+
+static void store_gpr(int r, int reg) {
+  if (r == 0) return;
+  if (host_reg[r] >= 0) x_rr(0, 0x89, reg, host_reg[r]);
+  else x_rm(0x89, reg, R15, GPR_OFF(r));
+}
+
+// leave the block with `count' instructions executed and pc = `pc'
+static void emit_exit(vaddr_t pc, int count) {
+  emit_op(0, 0xc7, 0, 0, R15);  // mov dword [r15 + PC_OFF], pc
+  modrm(2, 0, R15);
+  emit32(PC_OFF);
+  emit32(pc);
+  x_mov_ri(RAX, count);
+  exits[nr_exit ++] = x_jmp();
+}
+
+// edx = eax - CONFIG_MBASE, jump to the returned patch point if
+// [eax, eax + len) is not inside pmem
+__attribute__((unused))
+static uint8_t *emit_pmem_check(int len) {
+  x_rr(0, 0x89, RAX, RDX);
+  x_ri(5, RDX, CONFIG_MBASE);
+  x_ri(7, RDX, CONFIG_MSIZE - len + 1);
+  return x_jcc(CC_AE);
+}
+
+// eax = M[eax]
+static void emit_load(int len, bool sign) {
+#ifndef CONFIG_JIT_VERIFY
+  uint8_t *slow = emit_pmem_check(len);
+  x_mov_ri64(RSI, (uintptr_t)guest_to_host(CONFIG_MBASE));
+  uint32_t op = (len == 4 ? 0x8b : len == 2 ? (sign ? 0x0fbf : 0x0fb7) : (sign ? 0x0fbe : 0x0fb6));
+  x_rsib(op, RAX, RSI, RDX);
+  uint8_t *done = x_jmp();
+  patch(slow, p);
+#endif
+  x_rr(0, 0x89, RAX, RDI);
+  x_mov_ri(RSI, len);
+  x_call(jit_load);
+  if (sign && len < 4) x_rr(0, len == 1 ? 0x0fbe : 0x0fbf, RAX, RAX);
+  IFNDEF(CONFIG_JIT_VERIFY, patch(done, p));
+}
+
+// M[eax] = ecx, `s' is the `idx'-th instruction of the block
+static void emit_store(Decode *s, int idx, int len) {
+#ifndef CONFIG_JIT_VERIFY
+  uint8_t *slow[3];
+  int nr_slow = 0;
+  slow[nr_slow ++] = emit_pmem_check(len);
+  if (len > 1) {
+    // an unaligned store may cross a page
+    emit_op(0, 0xf7, 0, 0, RAX);  // test eax, len - 1
+    modrm(3, 0, RAX);
+    emit32(len - 1);
+    slow[nr_slow ++] = x_jcc(CC_NE);
+  }
+  // stores to code pages should drop the blocks inside
+  x_rr(0, 0x89, RDX, R8);
+  x_shift_i(0, 5, R8, PAGE_SHIFT);
+  x_rr(0, 0x89, R8, R9);
+  x_shift_i(0, 5, R9, 5);
+  x_shift_i(0, 4, R9, 2);
+  x_mov_ri64(RSI, (uintptr_t)paddr_code_bitmap());
+  x_rsib(0x8b, R9, RSI, R9);   // r9d = word of the page in the bitmap
+  x_rr(0, 0x0fa3, R8, R9);     // bt r9d, r8d
+  slow[nr_slow ++] = x_jcc(CC_B);
+#ifdef CONFIG_PMEM_DIRTY
+  x_mov_ri64(RSI, (uintptr_t)pmem_dirty);
+  emit_op(0, 0xc6, 0, R8, RSI);  // mov byte [rsi + r8], 1
+  modrm(0, 0, 4);
+  emit8(((R8 & 7) << 3) | RSI);
+  emit8(1);
+#endif
+  x_mov_ri64(RSI, (uintptr_t)guest_to_host(CONFIG_MBASE));
+  x_rsib(len == 4 ? 0x89 : len == 2 ? 0x660089 : 0x88, RCX, RSI, RDX);
+  uint8_t *done = x_jmp();
+  int i;
+  for (i = 0; i < nr_slow; i ++) patch(slow[i], p);
+#endif
+  x_rr(0, 0x89, RAX, RDI);
+  x_mov_ri(RSI, len);
+  x_rr(0, 0x89, RCX, RDX);
+  x_call(jit_store);
+  x_rr(0, 0x85, RAX, RAX);  // test eax, eax
+  uint8_t *cont = x_jcc(CC_E);
+  emit_exit(s->snpc, idx + 1);
+  patch(cont, p);
+  IFNDEF(CONFIG_JIT_VERIFY, patch(done, p));
+}
+
+/* Translate the `idx'-th instruction `s' of the block. Return false if
+ * it is not supported, and nothing should be emitted in this case.
+ * Set `end' if the instruction always leaves the block. */
+static bool translate(Decode *s, int idx, bool *end) {
+  uint32_t inst = s->isa.inst;
+  int funct3 = BITS(inst, 14, 12), funct7 = BITS(inst, 31, 25);
+  int rd = s->isa.rd, rs1 = s->isa.rs1, rs2 = s->isa.rs2;
+  word_t imm = s->isa.imm;
+  static const int branch_cc[8] = { CC_E, CC_NE, -1, -1, CC_L, CC_GE, CC_B, CC_AE };
+
+  switch (BITS(inst, 6, 0)) {
+    case 0x37: x_mov_ri(RAX, imm); break;  // lui
+    case 0x17: x_mov_ri(RAX, s->pc + imm); break;  // auipc
+
+    case 0x03:  // loads
+      if (funct3 == 3 || funct3 > 5) return false;
+      load_gpr(RAX, rs1);
+      x_ri(0, RAX, imm);
+      emit_load(1 << (funct3 & 3), !(funct3 & 4));
+      break;
+
+    case 0x23:  // stores
+      if (funct3 > 2) return false;
+      load_gpr(RAX, rs1);
+      x_ri(0, RAX, imm);
+      load_gpr(RCX, rs2);
+      emit_store(s, idx, 1 << funct3);
+      return true;
+
+    case 0x13:  // I-type arithmetic
+      if ((funct3 == 1 && funct7 != 0) || (funct3 == 5 && (funct7 & ~0x20) != 0)) return false;
+      load_gpr(RAX, rs1);
+      switch (funct3) {
+        case 0: x_ri(0, RAX, imm); break;
+        case 1: x_shift_i(0, 4, RAX, imm & 0x1f); break;
+        case 2: x_ri(7, RAX, imm); x_setcc(CC_L); break;
+        case 3: x_ri(7, RAX, imm); x_setcc(CC_B); break;
+        case 4: x_ri(6, RAX, imm); break;
+        case 5: x_shift_i(0, funct7 ? 7 : 5, RAX, imm & 0x1f); break;
+        case 6: x_ri(1, RAX, imm); break;
+        case 7: x_ri(4, RAX, imm); break;
+      }
+      break;
+
+    case 0x33:  // R-type arithmetic
+      if (funct7 == 0x20 ? (funct3 != 0 && funct3 != 5) : (funct7 != 0 && funct7 != 1)) return false;
+      load_gpr(RAX, rs1);
+      load_gpr(RCX, rs2);
+      if (funct7 == 1) {
+        switch (funct3) {
+          case 0: x_rr(0, 0x0faf, RAX, RCX); break;  // imul eax, ecx
+          case 1: case 2: case 3:
+            // eax and ecx are zero-extended, sign-extend them if needed
+            if (funct3 != 3) x_rr(1, 0x63, RAX, RAX);  // movsxd rax, eax
+            if (funct3 == 1) x_rr(1, 0x63, RCX, RCX);
+            x_rr(1, 0x0faf, RAX, RCX);
+            x_shift_i(1, 5, RAX, 32);
+            break;
+          default:
+            x_rr(0, 0x89, RAX, RDI);
+            x_rr(0, 0x89, RCX, RSI);
+            x_mov_ri(RDX, funct3);
+            x_call(jit_div);
+            break;
+        }
+        break;
+      }
+      switch (funct3) {
+        case 0: x_rr(0, funct7 ? 0x29 : 0x01, RCX, RAX); break;  // sub/add
+        case 1: x_shift_cl(4, RAX); break;
+        case 2: x_rr(0, 0x39, RCX, RAX); x_setcc(CC_L); break;
+        case 3: x_rr(0, 0x39, RCX, RAX); x_setcc(CC_B); break;
+        case 4: x_rr(0, 0x31, RCX, RAX); break;
+        case 5: x_shift_cl(funct7 ? 7 : 5, RAX); break;
+        case 6: x_rr(0, 0x09, RCX, RAX); break;
+        case 7: x_rr(0, 0x21, RCX, RAX); break;
+      }
+      break;
+
+    case 0x63: {  // branches
+      if (branch_cc[funct3] < 0) return false;
+      load_gpr(RAX, rs1);
+      load_gpr(RCX, rs2);
+      x_rr(0, 0x39, RCX, RAX);
+      uint8_t *not_taken = x_jcc(branch_cc[funct3] ^ 1);
+      emit_exit(s->pc + imm, idx + 1);
+      patch(not_taken, p);
+      return true;
+    }
+
+    case 0x6f:  // jal
+      x_mov_ri(RAX, s->snpc);
+      store_gpr(rd, RAX);
+      emit_exit(s->pc + imm, idx + 1);
+      *end = true;
+      return true;
+
+    case 0x67:  // jalr
+      if (funct3 != 0) return false;
+      load_gpr(RCX, rs1);
+      x_ri(0, RCX, imm);
+      x_ri(4, RCX, ~(word_t)1);
+      x_rm(0x89, RCX, R15, PC_OFF);
+      x_mov_ri(RAX, s->snpc);
+      store_gpr(rd, RAX);
+      x_mov_ri(RAX, idx + 1);
+      exits[nr_exit ++] = x_jmp();
+      *end = true;
+      return true;
+
+    default: return false;
+  }
+  store_gpr(rd, RAX);
+  return true;
+}
+
+// keep the most used guest registers of the block in host registers
+static void alloc_host_reg(TBlock *b, int nr) {
+  int count[32] = {};
+  int i, j;
+  for (i = 0; i < nr; i ++) {
+    Decode *s = &b->code[i];
+    count[s->isa.rd] ++;
+    count[s->isa.rs1] ++;
+    count[s->isa.rs2] ++;
+  }
+  count[0] = 0;
+  for (i = 0; i < 32; i ++) host_reg[i] = -1;
+  for (j = 0; j < NR_HOST_REG; j ++) {
+    int max = 0;
+    for (i = 1; i < 32; i ++) {
+      if (host_reg[i] < 0 && count[i] > count[max]) max = i;
+    }
+    if (max == 0) break;
+    host_reg[max] = alloc_reg[j];
+  }
+}
+
+static int (*compile(TBlock *b))(CPU_state *) {
+  uint8_t *start = p;
+  nr_exit = 0;
+  alloc_host_reg(b, b->nr);
+
+  // prologue
+  int i;
+  for (i = 0; i < NR_HOST_REG; i ++) x_push(alloc_reg[i]);
+  x_push(R15);
+  emit8(0x48); emit8(0x83); emit8(0xec); emit8(0x08);  // sub rsp, 8 to align the stack
+  x_rr(1, 0x89, RDI, R15);
+  for (i = 1; i < 32; i ++) {
+    if (host_reg[i] >= 0) x_rm(0x8b, host_reg[i], R15, GPR_OFF(i));
+  }
+
+  bool end = false;
+  for (i = 0; i < b->nr && !end; i ++) {
+    uint8_t *save = p;
+    int save_exit = nr_exit;
+    if (!translate(&b->code[i], i, &end)) {
+      p = save;
+      nr_exit = save_exit;
+      break;
+    }
+  }
+  if (i == 0) {
+    p = start;
+    return NULL;
+  }
+  if (!end) emit_exit(b->code[i - 1].snpc, i);
+
+  // epilogue
+  for (i = 0; i < nr_exit; i ++) patch(exits[i], p);
+  for (i = 1; i < 32; i ++) {
+    if (host_reg[i] >= 0) x_rm(0x89, host_reg[i], R15, GPR_OFF(i));
+  }
+  emit8(0x48); emit8(0x83); emit8(0xc4); emit8(0x08);  // add rsp, 8
+  x_pop(R15);
+  for (i = NR_HOST_REG - 1; i >= 0; i --) x_pop(alloc_reg[i]);
+  emit8(0xc3);  // ret
+  Assert(p - start <= MAX_BLOCK_CODE, "host code of block " FMT_WORD " is too large", b->pc);
+  return (int (*)(CPU_state *))start;
+}
+
+#ifdef CONFIG_JIT_VERIFY
+/* Run the host code, roll back the effects, then run the block in the
+ * threaded engine from the same state and compare the results. */
+static int verify_exec(TBlock *b) {
+  CPU_state ref = cpu;
+  nr_store = 0;
+  touch_device = false;
+  int nr = b->jit(&cpu);
+  // device accesses can not be replayed, and dropped blocks are gone
+  if (touch_device || b->code->handler == NULL) return nr;
+
+  CPU_state dut = cpu;
+  word_t dut_val[TB_MAX_INST];
+  int i;
+  for (i = 0; i < nr_store; i ++) {
+    dut_val[i] = host_read(guest_to_host(store_log[i].addr), store_log[i].len);
+  }
+  for (i = nr_store - 1; i >= 0; i --) {
+    host_write(guest_to_host(store_log[i].addr), store_log[i].len, store_log[i].old);
+  }
+  cpu = ref;
+  int nr_ref = isa_exec_block(b->code, nr);
+  cpu.pc = b->code[nr_ref - 1].dnpc;
+
+  bool ok = (nr == nr_ref && cpu.pc == dut.pc);
+  for (i = 0; i < 32; i ++) {
+    if (cpu.gpr[i] != dut.gpr[i]) {
+      Log("x%d: jit = " FMT_WORD ", ref = " FMT_WORD, i, dut.gpr[i], cpu.gpr[i]);
+      ok = false;
+    }
+  }
+  for (i = 0; i < nr_store; i ++) {
+    word_t ref_val = host_read(guest_to_host(store_log[i].addr), store_log[i].len);
+    if (ref_val != dut_val[i]) {
+      Log("M[" FMT_PADDR "]: jit = " FMT_WORD ", ref = " FMT_WORD, store_log[i].addr, dut_val[i], ref_val);
+      ok = false;
+    }
+  }
+  if (!ok) {
+    panic("host code of block " FMT_WORD " mismatches: %d instructions to pc = " FMT_WORD
+        ", ref: %d instructions to pc = " FMT_WORD, b->pc, nr, dut.pc, nr_ref, cpu.pc);
+  }
+  g_nr_verify ++;
+  return nr;
+}
+#endif
+
+int jit_exec(TBlock *b) {
+  // host code accesses pmem by physical address
+  if (isa_mmu_check(b->pc, 4, MEM_TYPE_IFETCH) == MMU_TRANSLATE) return 0;
+  if (b->jit == NULL) {
+    if (b->no_jit || ++ b->nr_exec < CONFIG_JIT_THRESHOLD) return 0;
+    if (arena == NULL) {
+      arena = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      Assert(arena != MAP_FAILED, "can not allocate the JIT code arena");
+      p = arena;
+    }
+    if (p + MAX_BLOCK_CODE > arena + ARENA_SIZE) {
+      // `b' is dropped, but its instructions can still be interpreted
+      tcache_flush();
+      return 0;
+    }
+    b->jit = compile(b);
+    if (b->jit == NULL) {
+      b->no_jit = true;
+      return 0;
+    }
+    g_nr_compile ++;
+  }
+  cur_block = b;
+  int nr = MUXDEF(CONFIG_JIT_VERIFY, verify_exec(b), b->jit(&cpu));
+  g_nr_native += nr;
+  return nr;
+}
+
+void jit_flush() {
+  p = arena;
+}
+
+void jit_statistic() {
+  Log("compiled blocks = %" PRIu64 ", instructions in host code = %" PRIu64,
+      g_nr_compile, g_nr_native);
+  IFDEF(CONFIG_JIT_VERIFY, Log("verified block runs = %" PRIu64, g_nr_verify));
+}
+
+#endif
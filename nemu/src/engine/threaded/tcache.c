@@ -0,0 +1,128 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* The code cache of the threaded engine. A block is an array of
+ * pre-decoded instructions terminated by an entry without handler.
+ * Blocks are looked up by their start pc in a hash table, and they
+ * never cross a page, so that a write to a code page only has to drop
+ * the blocks starting in that page. Memory of dropped blocks is only
+ * reclaimed when the whole cache is flushed.
+ */
+
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include "tcache.h"
+#ifdef CONFIG_ENGINE_JIT
+#include "jit.h"
+#endif
+
+#define TCACHE_SIZE CONFIG_TCACHE_SIZE
+#define NR_TB (TCACHE_SIZE / 4)
+#define NR_BUCKET 4096
+
+#if TCACHE_SIZE < 2 * (TB_MAX_INST + 1)
+#error "CONFIG_TCACHE_SIZE is too small to hold a block"
+#endif
+
+static Decode code_buf[TCACHE_SIZE] = {};
+static int code_used = 0;
+static TBlock tb[NR_TB] = {};
+static int nr_tb = 0;
+static TBlock *bucket[NR_BUCKET] = {};
+static uint64_t g_nr_translate = 0, g_nr_flush = 0;
+
+static inline TBlock **tb_bucket(vaddr_t pc) {
+  return &bucket[(pc / 4) & (NR_BUCKET - 1)];
+}
+
+/* Drop all blocks. The instructions of the blocks are kept in place
+ * until a new block is allocated. */
+void tcache_flush() {
+  memset(bucket, 0, sizeof(bucket));
+  nr_tb = 0;
+  code_used = 0;
+  g_nr_flush ++;
+  IFDEF(CONFIG_ENGINE_JIT, jit_flush());
+}
+
+// return the block starting at `pc', or NULL if it is not translated
+TBlock *tcache_lookup(vaddr_t pc) {
+  TBlock *b;
+  for (b = *tb_bucket(pc); b != NULL; b = b->next) {
+    // the newest block is at the front, dropped ones have no handler
+    if (b->pc == pc) return (b->code->handler != NULL ? b : NULL);
+  }
+  return NULL;
+}
+
+/* Allocate a block starting at `pc' with room for TB_MAX_INST instructions.
+ * It should only be called between the execution of two blocks, since the
+ * whole cache may be flushed. */
+Decode *tcache_new_block(vaddr_t pc) {
+  if (code_used + TB_MAX_INST + 1 > TCACHE_SIZE || nr_tb == NR_TB) tcache_flush();
+  TBlock *b = &tb[nr_tb ++];
+  TBlock **head = tb_bucket(pc);
+  b->pc = pc;
+  b->nr = TB_MAX_INST;
+  b->code = &code_buf[code_used];
+  b->code->handler = NULL;
+#ifdef CONFIG_ENGINE_JIT
+  b->nr_exec = 0;
+  b->no_jit = false;
+  b->jit = NULL;
+#endif
+  b->next = *head;
+  *head = b;
+  vaddr_mark_code(pc);
+  g_nr_translate ++;
+  return b->code;
+}
+
+// finish the translation of the latest block with `nr' instructions
+void tcache_end_block(Decode *code, int nr) {
+  TBlock *b = &tb[nr_tb - 1];
+  Assert(b->code == code && nr > 0 && nr <= TB_MAX_INST,
+      "invalid block at pc = " FMT_WORD " with %d instructions", b->pc, nr);
+  b->nr = nr;
+  code[nr].handler = NULL;
+  code_used += nr + 1;
+}
+
+/* Drop all blocks starting inside the page starting at `page'.
+ * This is called when the guest writes to a page holding blocks. */
+void decode_cache_flush_page(vaddr_t page) {
+  int i, j;
+  for (i = 0; i < nr_tb; i ++) {
+    TBlock *b = &tb[i];
+    if (b->pc - page < PAGE_SIZE) {
+      for (j = 0; j < b->nr; j ++) b->code[j].handler = NULL;
+    }
+  }
+}
+
+/* Drop all blocks when the mapping of virtual addresses changes. Like
+ * decode_cache_flush_page(), this may be called inside a block, which is
+ * left after the current instruction. */
+void decode_cache_flush() {
+  int i;
+  for (i = 0; i < nr_tb; i ++) tb[i].code->handler = NULL;
+  for (i = 0; i < code_used; i ++) code_buf[i].handler = NULL;
+}
+
+void tcache_statistic() {
+  Log("translated blocks = %" PRIu64 ", code cache flushes = %" PRIu64,
+      g_nr_translate, g_nr_flush);
+  IFDEF(CONFIG_ENGINE_JIT, jit_statistic());
+}
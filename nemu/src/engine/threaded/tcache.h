@@ -0,0 +1,42 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __TCACHE_H__
+#define __TCACHE_H__
+
+#include <cpu/decode.h>
+
+// the maximum number of instructions in a block
+#define TB_MAX_INST 64
+
+typedef struct TBlock {
+  vaddr_t pc;
+  int nr;  // number of instructions, TB_MAX_INST if being translated
+  Decode *code;
+  struct TBlock *next;
+#ifdef CONFIG_ENGINE_JIT
+  uint32_t nr_exec;           // number of runs in the threaded engine
+  bool no_jit;                // the first instruction can not be compiled
+  int (*jit)(CPU_state *cpu); // compiled host code
+#endif
+} TBlock;
+
+TBlock *tcache_lookup(vaddr_t pc);
+Decode *tcache_new_block(vaddr_t pc);
+void tcache_end_block(Decode *code, int nr);
+void tcache_flush();
+void tcache_statistic();
+
+#endif
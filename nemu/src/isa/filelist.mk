@@ -15,3 +15,17 @@
 
 INC_PATH += $(NEMU_HOME)/src/isa/$(GUEST_ISA)/include
 DIRS-y += src/isa/$(GUEST_ISA)
+
+ifdef CONFIG_DECODE_TREE
+DECODE_TREE_GEN = $(NEMU_HOME)/tools/gen-decode/build/gen-decode
+DECODE_TREE_H = $(NEMU_HOME)/include/generated/decode-tree.h
+GEN_HEADERS += $(DECODE_TREE_H)
+
+$(DECODE_TREE_GEN):
+	$(MAKE) -s -C $(NEMU_HOME)/tools/gen-decode
+
+$(DECODE_TREE_H): src/isa/$(GUEST_ISA)/inst.c $(DECODE_TREE_GEN)
+	@echo + GEN $@
+	@$(DECODE_TREE_GEN) $< > $@.tmp
+	@mv $@.tmp $@
+endif
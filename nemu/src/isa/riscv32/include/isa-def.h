@@ -21,13 +21,26 @@
 typedef struct {
   word_t gpr[MUXDEF(CONFIG_RVE, 16, 32)];
   vaddr_t pc;
+  word_t mhartid;
+  word_t satp;
 } MUXDEF(CONFIG_RV64, riscv64_CPU_state, riscv32_CPU_state);
 
 // decode
 typedef struct {
   uint32_t inst;
+#ifdef CONFIG_PREDECODE
+  uint8_t rd, rs1, rs2;
+  word_t imm;
+#endif
+#ifdef CONFIG_INST_FUSION
+  uint8_t fuse;  // the idiom formed with the next instruction, or FUSE_NONE
+  uint8_t rd2;   // operands of the next instruction
+  word_t imm2;
+#endif
 } MUXDEF(CONFIG_RV64, riscv64_ISADecodeInfo, riscv32_ISADecodeInfo);
 
-#define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
+// only Sv32 is supported, so RV64 always uses bare addressing
+#define isa_mmu_check(vaddr, len, type) \
+  (MUXDEF(CONFIG_RV64, 0, cpu.satp >> 31) ? MMU_TRANSLATE : MMU_DIRECT)
 
 #endif
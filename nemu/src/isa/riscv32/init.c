@@ -34,6 +34,12 @@ static void restart() {
     cpu.gpr[0] = 0;
 }
 
+// reset the state of the hart running in the calling thread
+void init_isa_hart(int id) {
+    restart();
+    cpu.mhartid = id;
+}
+
 void init_isa() {
     /* Load built-in image. */
     memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
@@ -16,12 +16,11 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/ifetch.h>
+#include <memory/access.h>
 
 #include "local-include/reg.h"
 
 #define R(i) gpr(i)
-#define Mr vaddr_read
-#define Mw vaddr_write
 
 enum {
     TYPE_I,
@@ -102,17 +101,290 @@ static void decode_operand(Decode* s, int* rd, word_t* src1, word_t* src2,
         default:
             panic("unsupported type = %d", type);
     }
+#ifdef CONFIG_PREDECODE
+    // only keep the indices of the source registers which are really read,
+    // so that re-reading them on a cache hit is always valid
+    s->isa.rd = *rd;
+    s->isa.rs1 = (type == TYPE_I || type == TYPE_S || type == TYPE_B ||
+                  type == TYPE_R)
+                     ? rs1
+                     : 0;
+    s->isa.rs2 = (type == TYPE_S || type == TYPE_B || type == TYPE_R) ? rs2 : 0;
+    s->isa.imm = *imm;
+#endif
 }
 
-static int decode_exec(Decode* s) {
+// Zicsr, `op' is 0 (write), 1 (set bits) or 2 (clear bits). The CSR is
+// not written when `wen' is false, i.e. csrrs/csrrc with a zero source.
+static void satp_write(word_t val) {
+    // only Sv32 is supported, and the write has no effect on RV64
+    // unless it selects bare addressing
+    if (MUXDEF(CONFIG_RV64, (val >> 60) != 0, false)) return;
+    word_t old = cpu.satp;
+    cpu.satp = val;
+    // the TLB keeps the translations of other address spaces
+    if (BITS(val ^ old, 30, 22) != 0) {
+        tlb_switch_asid(BITS(val, 30, 22));
+    } else if (val != old) {
+        tlb_flush();
+    }
+}
+
+static word_t csr_op(Decode* s, uint32_t no, int op, word_t src, bool wen) {
+    word_t* p = NULL;
+    switch (no) {
+        case 0x180: p = &cpu.satp; break;
+        case 0xf14: p = &cpu.mhartid; break;
+    }
+    // CSRs with address[11:10] == 0b11 are read-only
+    if (p == NULL || (wen && BITS(no, 11, 10) == 3)) {
+        INV(s->pc);
+        return 0;
+    }
+    word_t old = *p;
+    if (wen) {
+        word_t val = (op == 0 ? src : op == 1 ? (old | src) : (old & ~src));
+        if (p == &cpu.satp) {
+            satp_write(val);
+        } else {
+            *p = val;
+        }
+    }
+    return old;
+}
+
+// A extension
+enum {
+    AMO_SWAP,
+    AMO_ADD,
+    AMO_XOR,
+    AMO_AND,
+    AMO_OR,
+    AMO_MIN,
+    AMO_MAX,
+    AMO_MINU,
+    AMO_MAXU
+};
+
+static inline word_t amo_calc(int op, word_t old, word_t src) {
+    switch (op) {
+        case AMO_SWAP: return src;
+        case AMO_ADD: return old + src;
+        case AMO_XOR: return old ^ src;
+        case AMO_AND: return old & src;
+        case AMO_OR: return old | src;
+        case AMO_MIN: return (int32_t)old < (int32_t)src ? old : src;
+        case AMO_MAX: return (int32_t)old > (int32_t)src ? old : src;
+        case AMO_MINU: return old < src ? old : src;
+        default: return old > src ? old : src;
+    }
+}
+
+// the reservation set of lr.w, which is a single word
+static HART_LOCAL bool lr_valid = false;
+static HART_LOCAL vaddr_t lr_addr = 0;
+static HART_LOCAL word_t lr_val = 0;
+
+#ifdef CONFIG_MULTI_HART
+// the memory shared by all harts is accessed with host atomics
+static inline uint32_t* amo_host_ptr(Decode* s, vaddr_t addr, int type) {
+    uint8_t* p = vaddr_to_host(addr, 4, type);
+    Assert(p != NULL && addr % 4 == 0,
+           "atomic access to address " FMT_WORD " at pc = " FMT_WORD
+           " is not supported",
+           addr, s->pc);
+    return (uint32_t*)p;
+}
+#endif
+
+static word_t amo(Decode* s, int op, vaddr_t addr, word_t src) {
+#ifdef CONFIG_MULTI_HART
+    uint32_t* p = amo_host_ptr(s, addr, MEM_TYPE_WRITE);
+    uint32_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(p, &old, amo_calc(op, old, src), false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        ;
+    return old;
+#else
+    word_t old = vaddr_read32(addr);
+    vaddr_write32(addr, amo_calc(op, old, src));
+    return old;
+#endif
+}
+
+static word_t lr(Decode* s, vaddr_t addr) {
+    word_t val = MUXDEF(CONFIG_MULTI_HART,
+                        __atomic_load_n(amo_host_ptr(s, addr, MEM_TYPE_READ),
+                                        __ATOMIC_SEQ_CST),
+                        vaddr_read32(addr));
+    lr_valid = true;
+    lr_addr = addr;
+    lr_val = val;
+    return val;
+}
+
+// return 0 on success, as the result of sc.w
+static word_t sc(Decode* s, vaddr_t addr, word_t src) {
+    bool ok = lr_valid && lr_addr == addr;
+    lr_valid = false;
+    if (!ok) return 1;
+#ifdef CONFIG_MULTI_HART
+    // succeed if the word still holds the value loaded by lr.w
+    uint32_t expected = lr_val;
+    uint32_t* p = amo_host_ptr(s, addr, MEM_TYPE_WRITE);
+    ok = __atomic_compare_exchange_n(p, &expected, src, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+#else
+    vaddr_write32(addr, src);
+#endif
+    return !ok;
+}
+
+#ifdef CONFIG_INST_FUSION
+enum {
+    FUSE_NONE,
+    FUSE_LUI_ADDI,
+    FUSE_AUIPC_JALR,
+    FUSE_AUIPC_LW,
+    FUSE_SLT_BEQZ,  // the order of the compare-and-branch idioms matters
+    FUSE_SLT_BNEZ,
+    FUSE_SLTU_BEQZ,
+    FUSE_SLTU_BNEZ,
+    NR_FUSE
+};
+
+static const char* fuse_name[NR_FUSE] = {
+    [FUSE_LUI_ADDI] = "lui+addi",     [FUSE_AUIPC_JALR] = "auipc+jalr",
+    [FUSE_AUIPC_LW] = "auipc+lw",     [FUSE_SLT_BEQZ] = "slt+beqz",
+    [FUSE_SLT_BNEZ] = "slt+bnez",     [FUSE_SLTU_BEQZ] = "sltu+beqz",
+    [FUSE_SLTU_BNEZ] = "sltu+bnez",
+};
+static uint64_t fuse_count[NR_FUSE] = {};
+
+/* Check whether the instruction just decoded at `s' forms an idiom with
+ * the next one, which must read the register written by `s'. Only pairs
+ * inside a page are fused, so that a write to the page drops both of
+ * them together. */
+static void fuse_pair(Decode* s) {
+    s->isa.fuse = FUSE_NONE;
+    int rd = s->isa.rd;
+    if (rd == 0 || ((s->pc + 4) & PAGE_MASK) == 0) return;
+
+    uint32_t a = s->isa.inst;
+    uint32_t i = vaddr_ifetch(s->pc + 4, 4);
+    int opa = BITS(a, 6, 0), f3a = BITS(a, 14, 12);
+    int op = BITS(i, 6, 0), f3 = BITS(i, 14, 12);
+    int rs1 = BITS(i, 19, 15), rs2 = BITS(i, 24, 20);
+    bool is_slt = (opa == 0x13 || (opa == 0x33 && BITS(a, 31, 25) == 0)) &&
+                  (f3a == 2 || f3a == 3);
+    int kind = FUSE_NONE;
+    if (opa == 0x37 && op == 0x13 && f3 == 0 && rs1 == rd) {
+        kind = FUSE_LUI_ADDI;
+    } else if (opa == 0x17 && op == 0x67 && f3 == 0 && rs1 == rd) {
+        kind = FUSE_AUIPC_JALR;
+    } else if (opa == 0x17 && op == 0x03 && f3 == 2 && rs1 == rd) {
+        kind = FUSE_AUIPC_LW;
+    } else if (is_slt && op == 0x63 && (f3 == 0 || f3 == 1) &&
+               ((rs1 == rd && rs2 == 0) || (rs1 == 0 && rs2 == rd))) {
+        kind = (f3a == 2 ? FUSE_SLT_BEQZ : FUSE_SLTU_BEQZ) + f3;
+    }
+    if (kind == FUSE_NONE) return;
+
+    word_t* imm = &s->isa.imm2;
+    if (op == 0x63) {
+        immB();
+    } else {
+        immI();
+    }
+    s->isa.rd2 = BITS(i, 11, 7);
+    s->isa.fuse = kind;
+}
+
+// Execute the pair fused at `s' with the restored operands of the first
+// instruction. The second instruction is at `s->snpc'.
+static inline void exec_fused(Decode* s, int rd, word_t src1, word_t src2,
+                              word_t imm) {
+    int kind = s->isa.fuse;
+    word_t t;
+    fuse_count[kind]++;
+    s->dnpc = s->snpc + 4;
+    switch (kind) {
+        case FUSE_LUI_ADDI:
+            R(rd) = imm;
+            R(s->isa.rd2) = imm + s->isa.imm2;
+            break;
+        case FUSE_AUIPC_JALR:
+            t = s->pc + imm;
+            R(rd) = t;
+            s->dnpc = (t + s->isa.imm2) & ~(word_t)1;
+            R(s->isa.rd2) = s->snpc + 4;
+            break;
+        case FUSE_AUIPC_LW:
+            t = s->pc + imm;
+            R(rd) = t;
+            R(s->isa.rd2) = vaddr_read32(t + s->isa.imm2);
+            break;
+        default:
+            // one of `src2' (slt) and `imm' (slti) is always 0
+            t = kind <= FUSE_SLT_BNEZ ? (int32_t)src1 < (int32_t)(src2 + imm)
+                                      : src1 < src2 + imm;
+            R(rd) = t;
+            if (t == (kind == FUSE_SLT_BNEZ || kind == FUSE_SLTU_BNEZ)) {
+                s->dnpc = s->snpc + s->isa.imm2;
+            }
+            break;
+    }
+}
+
+void isa_fusion_statistic() {
+    int i;
+    for (i = FUSE_NONE + 1; i < NR_FUSE; i++) {
+        Log("fused %s = %" PRIu64 " pairs", fuse_name[i], fuse_count[i]);
+    }
+}
+#endif
+
+// Execute at most `n' instructions starting from `s' and return the
+// number of instructions executed. Only the threaded engine runs more
+// than one instruction at a time, where `s' points to a pre-decoded block,
+// except that a fused pair runs as one macro-op if the budget allows.
+static int decode_exec(Decode* s, int n) {
+    int rd = 0;
+    word_t src1 = 0, src2 = 0, imm = 0;
+    int nr_exec = 0;
+
+#ifdef CONFIG_PREDECODE
+    // pre-decoded: restore the operands and jump to the execution body
+    if (s->handler != NULL) {
+        IFDEF(CONFIG_ENGINE_THREADED, dispatch:);
+        s->dnpc = s->snpc;
+        rd = s->isa.rd;
+        src1 = R(s->isa.rs1);
+        src2 = R(s->isa.rs2);
+        imm = s->isa.imm;
+#ifdef CONFIG_INST_FUSION
+        // in a block the second instruction should be the next entry
+        if (s->isa.fuse != FUSE_NONE && n - nr_exec >= 2 &&
+            MUXDEF(CONFIG_ENGINE_THREADED, s[1].handler != NULL, true)) {
+            exec_fused(s, rd, src1, src2, imm);
+            nr_exec++;
+            IFDEF(CONFIG_ENGINE_THREADED, s[1].dnpc = s->dnpc; s++);
+            goto finish;
+        }
+#endif
+        goto*(s->handler);
+    }
+#endif
     s->dnpc = s->snpc;
 
 #define INSTPAT_INST(s) ((s)->isa.inst)
-#define INSTPAT_MATCH(s, name, type, ... /* execute body */)             \
+#define INSTPAT_MATCH(s, name, type, ... /* execute body */)        \
+    INSTPAT_MATCH_LABEL(concat(__instpat_exec_, __LINE__), s, name, \
+                        type, __VA_ARGS__)
+#define INSTPAT_MATCH_LABEL(label, s, name, type, ...)                   \
     {                                                                    \
-        int rd = 0;                                                      \
-        word_t src1 = 0, src2 = 0, imm = 0;                              \
         decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+        IFDEF(CONFIG_PREDECODE, s->handler = &&label; label:);        \
         __VA_ARGS__;                                                     \
     }
 
@@ -124,23 +396,23 @@ static int decode_exec(Decode* s) {
 
     // I-type loads
     INSTPAT("??????? ????? ????? 000 ????? 00000 11", lb, I,
-            R(rd) = SEXT(Mr(src1 + imm, 1), 8));
+            R(rd) = vaddr_read8s(src1 + imm));
     INSTPAT("??????? ????? ????? 001 ????? 00000 11", lh, I,
-            R(rd) = SEXT(Mr(src1 + imm, 2), 16));
+            R(rd) = vaddr_read16s(src1 + imm));
     INSTPAT("??????? ????? ????? 010 ????? 00000 11", lw, I,
-            R(rd) = Mr(src1 + imm, 4));
+            R(rd) = vaddr_read32(src1 + imm));
     INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu, I,
-            R(rd) = Mr(src1 + imm, 1));
+            R(rd) = vaddr_read8(src1 + imm));
     INSTPAT("??????? ????? ????? 101 ????? 00000 11", lhu, I,
-            R(rd) = Mr(src1 + imm, 2));
+            R(rd) = vaddr_read16(src1 + imm));
 
     // S-type stores
     INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb, S,
-            Mw(src1 + imm, 1, src2));
+            vaddr_write8(src1 + imm, src2));
     INSTPAT("??????? ????? ????? 001 ????? 01000 11", sh, S,
-            Mw(src1 + imm, 2, src2));
+            vaddr_write16(src1 + imm, src2));
     INSTPAT("??????? ????? ????? 010 ????? 01000 11", sw, S,
-            Mw(src1 + imm, 4, src2));
+            vaddr_write32(src1 + imm, src2));
 
     // I-type arithmetic
     INSTPAT("??????? ????? ????? 000 ????? 00100 11", addi, I,
@@ -184,6 +456,30 @@ static int decode_exec(Decode* s) {
     INSTPAT("0000000 ????? ????? 111 ????? 01100 11", and, R,
             R(rd) = src1 & src2);
 
+    // A-extension (Atomic Instructions)
+    INSTPAT("00010?? 00000 ????? 010 ????? 01011 11", lr_w, R,
+            R(rd) = lr(s, src1));
+    INSTPAT("00011?? ????? ????? 010 ????? 01011 11", sc_w, R,
+            R(rd) = sc(s, src1, src2));
+    INSTPAT("00001?? ????? ????? 010 ????? 01011 11", amoswap_w, R,
+            R(rd) = amo(s, AMO_SWAP, src1, src2));
+    INSTPAT("00000?? ????? ????? 010 ????? 01011 11", amoadd_w, R,
+            R(rd) = amo(s, AMO_ADD, src1, src2));
+    INSTPAT("00100?? ????? ????? 010 ????? 01011 11", amoxor_w, R,
+            R(rd) = amo(s, AMO_XOR, src1, src2));
+    INSTPAT("01100?? ????? ????? 010 ????? 01011 11", amoand_w, R,
+            R(rd) = amo(s, AMO_AND, src1, src2));
+    INSTPAT("01000?? ????? ????? 010 ????? 01011 11", amoor_w, R,
+            R(rd) = amo(s, AMO_OR, src1, src2));
+    INSTPAT("10000?? ????? ????? 010 ????? 01011 11", amomin_w, R,
+            R(rd) = amo(s, AMO_MIN, src1, src2));
+    INSTPAT("10100?? ????? ????? 010 ????? 01011 11", amomax_w, R,
+            R(rd) = amo(s, AMO_MAX, src1, src2));
+    INSTPAT("11000?? ????? ????? 010 ????? 01011 11", amominu_w, R,
+            R(rd) = amo(s, AMO_MINU, src1, src2));
+    INSTPAT("11100?? ????? ????? 010 ????? 01011 11", amomaxu_w, R,
+            R(rd) = amo(s, AMO_MAXU, src1, src2));
+
     // M-extension (Multiplication and Division)
     INSTPAT("0000001 ????? ????? 000 ????? 01100 11", mul, R,
             R(rd) = src1 * src2);
@@ -242,17 +538,66 @@ static int decode_exec(Decode* s) {
             NEMUTRAP(s->pc, R(10)));  // R(10) is $a0
     INSTPAT("0011000 00010 00000 000 00000 11100 11", mret, N,
             s->dnpc = isa_raise_intr(R(10), s->pc));
+    INSTPAT("0001001 ????? ????? 000 00000 11100 11", sfence_vma, R,
+            if (BITS(s->isa.inst, 19, 15) == 0) tlb_flush();
+            else tlb_flush_page(src1));
+    INSTPAT("??????? ????? ????? 000 ????? 00011 11", fence, N,
+            IFDEF(CONFIG_MULTI_HART, __atomic_thread_fence(__ATOMIC_SEQ_CST)));
+    INSTPAT("??????? ????? ????? 001 ????? 00011 11", fence_i, N, );
+
+    // Zicsr, the immediate operand of csrr?i is in the field of rs1
+    INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw, I,
+            R(rd) = csr_op(s, BITS(imm, 11, 0), 0, src1, true));
+    INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs, I,
+            R(rd) = csr_op(s, BITS(imm, 11, 0), 1, src1,
+                           BITS(s->isa.inst, 19, 15) != 0));
+    INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc, I,
+            R(rd) = csr_op(s, BITS(imm, 11, 0), 2, src1,
+                           BITS(s->isa.inst, 19, 15) != 0));
+    INSTPAT("??????? ????? ????? 101 ????? 11100 11", csrrwi, I,
+            R(rd) = csr_op(s, BITS(imm, 11, 0), 0, BITS(s->isa.inst, 19, 15),
+                           true));
+    INSTPAT("??????? ????? ????? 110 ????? 11100 11", csrrsi, I,
+            R(rd) = csr_op(s, BITS(imm, 11, 0), 1, BITS(s->isa.inst, 19, 15),
+                           BITS(s->isa.inst, 19, 15) != 0));
+    INSTPAT("??????? ????? ????? 111 ????? 11100 11", csrrci, I,
+            R(rd) = csr_op(s, BITS(imm, 11, 0), 2, BITS(s->isa.inst, 19, 15),
+                           BITS(s->isa.inst, 19, 15) != 0));
 
     // Invalid instruction
     INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv, N, INV(s->pc));
     INSTPAT_END();
 
+    IFDEF(CONFIG_INST_FUSION, finish:);
     R(0) = 0;  // reset $zero to 0
+    nr_exec++;
 
-    return 0;
+#ifdef CONFIG_ENGINE_THREADED
+    // fall through to the next instruction of the block, which is
+    // terminated by an entry without handler
+    if (nr_exec < n && s->dnpc == s->snpc && s[1].handler != NULL &&
+        nemu_state.state == NEMU_RUNNING) {
+        s++;
+        goto dispatch;
+    }
+#endif
+    return nr_exec;
 }
 
 int isa_exec_once(Decode* s) {
+#ifdef CONFIG_PREDECODE
+    if (s->handler != NULL) {
+        s->snpc += 4;
+        decode_exec(s, 1);
+        return 0;
+    }
+#endif
     s->isa.inst = inst_fetch(&s->snpc, 4);
-    return decode_exec(s);
-}
\ No newline at end of file
+    decode_exec(s, 1);
+    IFDEF(CONFIG_INST_FUSION, fuse_pair(s));
+    return 0;
+}
+
+#ifdef CONFIG_PREDECODE
+int isa_exec_block(Decode* s, int n) { return decode_exec(s, n); }
+#endif
@@ -17,6 +17,42 @@
 #include <memory/vaddr.h>
 #include <memory/paddr.h>
 
+// bits of a page table entry
+enum {
+  PTE_V = 0x01, PTE_R = 0x02, PTE_W = 0x04, PTE_X = 0x08,
+  PTE_U = 0x10, PTE_G = 0x20, PTE_A = 0x40, PTE_D = 0x80,
+};
+
+#define PTE_PPN(pte) ((paddr_t)((pte) >> 10) << PAGE_SHIFT)
+
+/* Walk the Sv32 page table pointed by satp. Return the physical page
+ * holding `vaddr' or-ed with MEM_RET_OK, or MEM_RET_FAIL on a page fault.
+ * The A and D bits are set by the walker instead of raising a fault.
+ * There is only M-mode in NEMU, so the U bit is not checked, and the
+ * physical address is truncated to the width of paddr_t. */
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
+  static const uint32_t perm[] = {
+    [MEM_TYPE_IFETCH] = PTE_X, [MEM_TYPE_READ] = PTE_R, [MEM_TYPE_WRITE] = PTE_W,
+  };
+  paddr_t table = (paddr_t)BITS(cpu.satp, 21, 0) << PAGE_SHIFT;
+  int level;
+  for (level = 1; level >= 0; level --) {
+    int vpn = (level == 1 ? BITS(vaddr, 31, 22) : BITS(vaddr, 21, 12));
+    paddr_t pte_addr = table + vpn * 4;
+    uint32_t pte = paddr_read(pte_addr, 4);
+    if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))) return MEM_RET_FAIL;
+    if (!(pte & (PTE_R | PTE_X))) {
+      // pointer to the next level
+      table = PTE_PPN(pte);
+      continue;
+    }
+    // a leaf, and a superpage should be aligned
+    if (!(pte & perm[type]) || (level == 1 && BITS(pte, 19, 10) != 0)) return MEM_RET_FAIL;
+    uint32_t ad = PTE_A | (type == MEM_TYPE_WRITE ? PTE_D : 0);
+    if ((pte & ad) != ad) paddr_write(pte_addr, 4, pte | ad);
+    paddr_t page = PTE_PPN(pte);
+    if (level == 1) page |= vaddr & ((1u << 22) - 1) & ~PAGE_MASK;
+    return page | MEM_RET_OK;
+  }
   return MEM_RET_FAIL;
 }
@@ -43,6 +43,7 @@ typedef struct {
 typedef struct {
   uint8_t inst[16];
   uint8_t *p_inst;
+  int nr_fetched;  // bytes of inst[] fetched at the beginning of decoding
 } x86_ISADecodeInfo;
 
 enum { R_EAX, R_ECX, R_EDX, R_EBX, R_ESP, R_EBP, R_ESI, R_EDI };
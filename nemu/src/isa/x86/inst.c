@@ -41,20 +41,18 @@ typedef union {
 } SIB;
 
 static word_t x86_inst_fetch(Decode *s, int len) {
-#if defined(CONFIG_ITRACE) || defined(CONFIG_IQUEUE)
-  uint8_t *p = &s->isa.inst[s->snpc - s->pc];
-  word_t ret = inst_fetch(&s->snpc, len);
-  word_t ret_save = ret;
-  int i;
-  assert(s->snpc - s->pc < sizeof(s->isa.inst));
-  for (i = 0; i < len; i ++) {
-    p[i] = ret & 0xff;
-    ret >>= 8;
+  int off = s->snpc - s->pc;
+  if (likely(off + len <= s->isa.nr_fetched)) {
+    s->snpc += len;
+    return host_read(&s->isa.inst[off], len);
   }
-  return ret_save;
-#else
-  return inst_fetch(&s->snpc, len);
+  // the instruction continues on the next page
+  word_t ret = inst_fetch(&s->snpc, len);
+#if defined(CONFIG_ITRACE) || defined(CONFIG_IQUEUE)
+  assert(off + len <= sizeof(s->isa.inst));
+  memcpy(&s->isa.inst[off], &ret, len);
 #endif
+  return ret;
 }
 
 word_t reg_read(int idx, int width) {
@@ -186,6 +184,8 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
 int isa_exec_once(Decode *s) {
   bool is_operand_size_16 = false;
   uint8_t opcode = 0;
+  // fetch the longest instruction at once, the decoder then reads from inst[]
+  s->isa.nr_fetched = inst_fetch_buf(s->pc, s->isa.inst, sizeof(s->isa.inst));
 
 again:
   opcode = x86_inst_fetch(s, 1);
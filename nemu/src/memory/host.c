@@ -0,0 +1,73 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <memory/host.h>
+#include <memory/vaddr.h>
+
+#ifdef CONFIG_HOST_HUGEPAGE
+#include <sys/mman.h>
+
+static bool thp_enabled() {
+  char buf[128] = {};
+  FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+  if (fp == NULL) return false;
+  bool ok = fgets(buf, sizeof(buf), fp) != NULL && strstr(buf, "[never]") == NULL;
+  fclose(fp);
+  return ok;
+}
+
+void host_advise_huge(void *addr, size_t size, const char *name) {
+  // only the huge pages lying entirely inside the area can be used
+  uintptr_t start = ROUNDUP(addr, HUGE_PAGE_SIZE);
+  uintptr_t end = ROUNDDOWN((uintptr_t)addr + size, HUGE_PAGE_SIZE);
+#ifdef MADV_HUGEPAGE
+  if (start < end && thp_enabled() && madvise((void *)start, end - start, MADV_HUGEPAGE) == 0) {
+    Log("%s: %zu MiB backed by transparent huge pages", name, (size_t)(end - start) >> 20);
+    return;
+  }
+#endif
+  Log("%s: huge pages are not available, using %lu KiB pages", name, PAGE_SIZE >> 10);
+}
+
+void* host_alloc(size_t size, const char *name) {
+  size = ROUNDUP(size, HUGE_PAGE_SIZE);
+#ifdef MAP_HUGETLB
+  // without MAP_NORESERVE, this fails here instead of at the first touch
+  // if the hugetlbfs pool is too small
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p != MAP_FAILED) {
+    Log("%s: %zu MiB backed by hugetlbfs pages", name, size >> 20);
+    return p;
+  }
+#endif
+  // map one more huge page to align the area, then give back the slop
+  uint8_t *raw = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(raw != MAP_FAILED, "can not map %s", name);
+  uint8_t *start = (uint8_t *)ROUNDUP(raw, HUGE_PAGE_SIZE);
+  if (start != raw) munmap(raw, start - raw);
+  munmap(start + size, raw + HUGE_PAGE_SIZE - start);
+  host_advise_huge(start, size, name);
+  return start;
+}
+#else
+void* host_alloc(size_t size, const char *name) {
+  void *p = malloc(size);
+  Assert(p != NULL, "can not allocate %s", name);
+  return p;
+}
+#endif
@@ -15,38 +15,245 @@
 
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <cpu/aot.h>
 #include <device/mmio.h>
 #include <isa.h>
 
-#if   defined(CONFIG_PMEM_MALLOC)
-static uint8_t *pmem = NULL;
+#if   defined(CONFIG_PMEM_MALLOC) || defined(CONFIG_PMEM_MMAP)
+uint8_t *pmem = NULL;
+#elif defined(CONFIG_PMEM_SPARSE)
+#include <sys/mman.h>
+uint8_t **pmem_dir[PMEM_NR_TABLE] = {};
+#ifdef CONFIG_MEM_RANDOM
+static uint8_t random_byte = 0;
+#endif
+#ifdef CONFIG_MULTI_HART
+#include <pthread.h>
+static pthread_mutex_t sparse_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 #else // CONFIG_PMEM_GARRAY
-static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
+uint8_t pmem[CONFIG_MSIZE] MUXDEF(CONFIG_HOST_HUGEPAGE, HUGE_PG_ALIGN, PG_ALIGN) = {};
 #endif
 
+#ifdef CONFIG_PMEM_SPARSE
+static void *sparse_alloc(size_t size) {
+  // anonymous pages are zero, and only populated when they are touched
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  Assert(p != MAP_FAILED, "can not allocate %zu bytes for pmem", size);
+  return p;
+}
+
+// allocate the table and the chunk holding offset `off' of pmem
+static uint8_t *sparse_fill(paddr_t off) {
+  IFDEF(CONFIG_MULTI_HART, pthread_mutex_lock(&sparse_lock));
+  uint8_t ***table = &pmem_dir[off >> PMEM_TABLE_SHIFT];
+  if (*table == NULL) {
+    __atomic_store_n(table, sparse_alloc(PMEM_TABLE_LEN * sizeof(uint8_t *)), __ATOMIC_RELEASE);
+  }
+  uint8_t **chunk = &(*table)[(off >> PMEM_CHUNK_SHIFT) & (PMEM_TABLE_LEN - 1)];
+  if (*chunk == NULL) {
+    uint8_t *p = sparse_alloc(PMEM_CHUNK_SIZE);
+    IFDEF(CONFIG_MEM_RANDOM, memset(p, random_byte, PMEM_CHUNK_SIZE));
+    __atomic_store_n(chunk, p, __ATOMIC_RELEASE);
+  }
+  IFDEF(CONFIG_MULTI_HART, pthread_mutex_unlock(&sparse_lock));
+  return *chunk + (off & (PMEM_CHUNK_SIZE - 1));
+}
+
+uint8_t* guest_to_host(paddr_t paddr) {
+  paddr_t off = paddr - CONFIG_MBASE;
+  uint8_t *host = pmem_sparse_host(off);
+  return likely(host != NULL) ? host : sparse_fill(off);
+}
+
+// search the allocated chunks, which is slow but rarely needed
+paddr_t host_to_guest(uint8_t *haddr) {
+  int i, j;
+  for (i = 0; i < PMEM_NR_TABLE; i ++) {
+    if (pmem_dir[i] == NULL) continue;
+    for (j = 0; j < PMEM_TABLE_LEN; j ++) {
+      uint8_t *chunk = pmem_dir[i][j];
+      if (chunk != NULL && haddr >= chunk && haddr < chunk + PMEM_CHUNK_SIZE) {
+        return CONFIG_MBASE + ((paddr_t)i << PMEM_TABLE_SHIFT) +
+          ((paddr_t)j << PMEM_CHUNK_SHIFT) + (haddr - chunk);
+      }
+    }
+  }
+  panic("host address %p is not inside pmem", haddr);
+}
+#else
 uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
 paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
+#endif
 
 static word_t pmem_read(paddr_t addr, int len) {
+#ifdef CONFIG_PMEM_SPARSE
+  if (unlikely(paddr_host_span(addr, len) < len)) {
+    // an unaligned access across two chunks
+    word_t ret = 0;
+    int i;
+    for (i = len - 1; i >= 0; i --) ret = (ret << 8) | *guest_to_host(addr + i);
+    return ret;
+  }
+#endif
   word_t ret = host_read(guest_to_host(addr), len);
   return ret;
 }
 
+#ifdef CONFIG_PREDECODE
+#define NR_PMEM_PAGE (CONFIG_MSIZE / PAGE_SIZE)
+// code_vpage[] holds this if the code of a page is cached under several virtual pages
+#define VPAGE_ALIASED ((vaddr_t)1)
+
+uint32_t pmem_code_bitmap[(NR_PMEM_PAGE + 31) / 32] = {};
+// the virtual page through which the code of each page is cached
+static vaddr_t code_vpage[NR_PMEM_PAGE] = {};
+
+static inline int pmem_page_idx(paddr_t addr) {
+  return (addr - CONFIG_MBASE) >> PAGE_SHIFT;
+}
+
+void paddr_mark_code(paddr_t addr, vaddr_t vaddr) {
+  if (unlikely(!in_pmem(addr))) return;
+  int idx = pmem_page_idx(addr);
+  vaddr_t vpage = vaddr & ~PAGE_MASK;
+  if (!pmem_page_is_code(idx)) {
+    pmem_code_bitmap[idx / 32] |= 1u << (idx % 32);
+    code_vpage[idx] = vpage;
+    tlb_protect_code(addr & ~PAGE_MASK);
+  } else if (code_vpage[idx] != vpage) {
+    code_vpage[idx] = VPAGE_ALIASED;
+  }
+}
+
+bool paddr_is_code(paddr_t addr) {
+  return in_pmem(addr) && pmem_page_is_code(pmem_page_idx(addr));
+}
+
+const uint32_t *paddr_code_bitmap() { return pmem_code_bitmap; }
+
+// drop the cached code of the page at `idx', which is being written
+static void drop_code_page(int idx) {
+  void decode_cache_flush();
+  void decode_cache_flush_page(vaddr_t page);
+  pmem_code_bitmap[idx / 32] &= ~(1u << (idx % 32));
+  if (code_vpage[idx] == VPAGE_ALIASED) decode_cache_flush();
+  else decode_cache_flush_page(code_vpage[idx]);
+  IFDEF(CONFIG_AOT, aot_flush_page(CONFIG_MBASE + ((paddr_t)idx << PAGE_SHIFT)));
+}
+
+static inline void check_code_page(paddr_t addr, int len) {
+  int idx = pmem_page_idx(addr);
+  if (unlikely(pmem_page_is_code(idx))) drop_code_page(idx);
+  // only an unaligned write may cross a page
+  if (unlikely(pmem_page_idx(addr + len - 1) != idx)) {
+    if (idx + 1 < NR_PMEM_PAGE && pmem_page_is_code(idx + 1)) drop_code_page(idx + 1);
+  }
+}
+#endif
+
+#ifdef CONFIG_PMEM_DIRTY
+// padded to a multiple of 8 flags for paddr_dirty_fetch_and_clear(), the padding is never set
+uint8_t pmem_dirty[(CONFIG_MSIZE / PAGE_SIZE + 7) / 8 * 8] = {};
+
+int paddr_dirty_fetch_and_clear(uint64_t *bitmap) {
+  int i, j, nr_dirty = 0;
+  memset(bitmap, 0, PMEM_DIRTY_WORDS * sizeof(uint64_t));
+  // scan 8 flags at a time, most of them are clean
+  for (i = 0; i < ARRLEN(pmem_dirty); i += 8) {
+    uint64_t flags;
+    memcpy(&flags, &pmem_dirty[i], 8);
+    if (flags == 0) continue;
+    for (j = i; j < i + 8; j ++) {
+      if (pmem_dirty[j]) {
+        bitmap[j / 64] |= 1ull << (j % 64);
+        nr_dirty ++;
+      }
+    }
+    memset(&pmem_dirty[i], 0, 8);
+  }
+  return nr_dirty;
+}
+#endif
+
 static void pmem_write(paddr_t addr, int len, word_t data) {
+#ifdef CONFIG_PMEM_SPARSE
+  if (unlikely(paddr_host_span(addr, len) < len)) {
+    int i;
+    for (i = 0; i < len; i ++) *guest_to_host(addr + i) = data >> (i * 8);
+  } else
+#endif
   host_write(guest_to_host(addr), len, data);
+  IFDEF(CONFIG_PMEM_DIRTY, pmem_mark_dirty(addr));
+  IFDEF(CONFIG_PMEM_DIRTY, pmem_mark_dirty(addr + len - 1));
+  IFDEF(CONFIG_PREDECODE, check_code_page(addr, len));
 }
 
+#if defined(CONFIG_PMEM_MMAP) && !defined(CONFIG_HOST_HUGEPAGE)
+#include <signal.h>
+#include <sys/mman.h>
+
+#ifdef CONFIG_PMEM_LAZY_RANDOM
+/* Pages of pmem are mapped without access at first. The first touch of
+ * a page traps into the SIGSEGV handler, which fills the page with the
+ * same value as memset() in init_mem() would have used. */
+static uint8_t random_byte = 0;
+
+static void pmem_fault_handler(int sig, siginfo_t *info, void *ucontext) {
+  uint8_t *addr = info->si_addr;
+  if (addr >= pmem && addr < pmem + CONFIG_MSIZE) {
+    uint8_t *page = (uint8_t *)((uintptr_t)addr & ~PAGE_MASK);
+    if (mprotect(page, PAGE_SIZE, PROT_READ | PROT_WRITE) == 0) {
+      memset(page, random_byte, PAGE_SIZE);
+      return;
+    }
+  }
+  // not a first touch of pmem, crash at the faulting access as usual
+  signal(SIGSEGV, SIG_DFL);
+}
+
+void paddr_touch(paddr_t addr, size_t len) {
+  size_t off;
+  for (off = 0; off < len; off += PAGE_SIZE) {
+    (void)*(volatile uint8_t *)guest_to_host(addr + off);
+  }
+  if (len > 0) (void)*(volatile uint8_t *)guest_to_host(addr + len - 1);
+}
+#endif
+
+static void init_pmem_mmap() {
+  int prot = MUXDEF(CONFIG_PMEM_LAZY_RANDOM, PROT_NONE, PROT_READ | PROT_WRITE);
+  pmem = mmap(NULL, CONFIG_MSIZE, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(pmem != MAP_FAILED, "can not map pmem");
+#ifdef CONFIG_PMEM_LAZY_RANDOM
+  random_byte = rand();
+  struct sigaction sa = { .sa_sigaction = pmem_fault_handler, .sa_flags = SA_SIGINFO };
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGSEGV, &sa, NULL);
+#endif
+}
+#endif
+
 static void out_of_bound(paddr_t addr) {
   panic("address = " FMT_PADDR " is out of bound of pmem [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
       addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
 }
 
 void init_mem() {
-#if   defined(CONFIG_PMEM_MALLOC)
-  pmem = malloc(CONFIG_MSIZE);
-  assert(pmem);
+#if   defined(CONFIG_PMEM_MALLOC) || (defined(CONFIG_PMEM_MMAP) && defined(CONFIG_HOST_HUGEPAGE))
+  pmem = host_alloc(CONFIG_MSIZE, "pmem");
+#elif defined(CONFIG_PMEM_MMAP)
+  init_pmem_mmap();
+#elif defined(CONFIG_PMEM_SPARSE)
+  // chunks are filled when they are allocated
+  IFDEF(CONFIG_MEM_RANDOM, random_byte = rand());
+#elif defined(CONFIG_HOST_HUGEPAGE)
+  host_advise_huge(pmem, CONFIG_MSIZE, "pmem");
+#endif
+#if defined(CONFIG_MEM_RANDOM) && !defined(CONFIG_PMEM_LAZY_RANDOM) && !defined(CONFIG_PMEM_SPARSE)
+  memset(pmem, rand(), CONFIG_MSIZE);
 #endif
-  IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE));
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
@@ -14,16 +14,186 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <cpu/ifetch.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+/* A direct-mapped software TLB in front of isa_mmu_translate(). An entry
+ * maps a guest virtual page to host memory inside pmem, and it has one tag
+ * for each type of access, which is only filled after the page table walk
+ * has checked the permission of that type. A tag holds the virtual page,
+ * the address space id and a valid bit. The low bits of an unaligned
+ * address are kept in the key, so a hit costs a single compare and never
+ * crosses a page. Pages outside pmem are not cached.
+ */
+#define NR_TLB 256
+#define TLB_VALID (1ull << 32)
+#define TLB_ASID_SHIFT 33
+
+typedef struct {
+  uint64_t tag[3];   // indexed by MEM_TYPE_*
+  uintptr_t addend;  // host address - guest virtual address
+} TLBEntry;
+
+static HART_LOCAL TLBEntry tlb[NR_TLB] = {};
+static HART_LOCAL uint64_t tlb_ctx = TLB_VALID;  // or-ed into all tags
+HART_LOCAL IFetchWindow ifetch_window = { .page = IFETCH_INVALID };
+
+static const char *type_name[] = {
+  [MEM_TYPE_IFETCH] = "instruction fetch", [MEM_TYPE_READ] = "load", [MEM_TYPE_WRITE] = "store",
+};
+
+static inline TLBEntry *tlb_entry(vaddr_t addr) {
+  return &tlb[(addr >> PAGE_SHIFT) & (NR_TLB - 1)];
+}
+
+static inline uint64_t tlb_key(vaddr_t addr, int len) {
+  return (addr & (~PAGE_MASK | (len - 1))) | tlb_ctx;
+}
+
+static inline uint8_t *tlb_lookup(vaddr_t addr, int len, int type) {
+  TLBEntry *e = tlb_entry(addr);
+  if (likely(e->tag[type] == tlb_key(addr, len))) return (uint8_t *)(uintptr_t)(addr + e->addend);
+  return NULL;
+}
+
+static void tlb_fill(vaddr_t addr, paddr_t paddr, int type) {
+  if (!in_pmem(paddr)) return;
+#ifdef CONFIG_PREDECODE
+  // writes to code pages should reach paddr_write() to drop the code
+  if (type == MEM_TYPE_WRITE && paddr_is_code(paddr)) return;
+#endif
+  TLBEntry *e = tlb_entry(addr);
+  vaddr_t page = addr & ~PAGE_MASK;
+  uintptr_t addend = (uintptr_t)guest_to_host(paddr & ~PAGE_MASK) - page;
+  // the other tags are still valid if they map to the same host page
+  if (e->addend != addend) memset(e->tag, 0, sizeof(e->tag));
+  e->tag[type] = tlb_key(page, 1);
+  e->addend = addend;
+}
+
+// exceptions are not supported, so a page fault aborts NEMU
+static paddr_t vaddr_translate(vaddr_t addr, int len, int type) {
+  paddr_t page = isa_mmu_translate(addr, len, type);
+  Assert((page & PAGE_MASK) == MEM_RET_OK, "page fault on %s at address = " FMT_WORD " at pc = " FMT_WORD,
+      type_name[type], addr, cpu.pc);
+  paddr_t paddr = page | (addr & PAGE_MASK);
+  tlb_fill(addr, paddr, type);
+  return paddr;
+}
+
+static inline bool cross_page(vaddr_t addr, int len) {
+  return (addr & PAGE_MASK) + len > PAGE_SIZE;
+}
+
+static word_t vaddr_read_slow(vaddr_t addr, int len, int type) {
+  if (cross_page(addr, len)) {
+    word_t data = 0;
+    int i;
+    for (i = 0; i < len; i ++) data |= vaddr_read_slow(addr + i, 1, type) << (i * 8);
+    return data;
+  }
+  return paddr_read(vaddr_translate(addr, len, type), len);
+}
+
+static void vaddr_write_slow(vaddr_t addr, int len, word_t data) {
+  if (cross_page(addr, len)) {
+    int i;
+    for (i = 0; i < len; i ++) vaddr_write_slow(addr + i, 1, data >> (i * 8));
+    return;
+  }
+  paddr_write(vaddr_translate(addr, len, MEM_TYPE_WRITE), len, data);
+}
+
+static inline word_t vaddr_load(vaddr_t addr, int len, int type) {
+  if (isa_mmu_check(addr, len, type) != MMU_TRANSLATE) return paddr_read(addr, len);
+  uint8_t *host = tlb_lookup(addr, len, type);
+  if (likely(host != NULL)) return host_read(host, len);
+  return vaddr_read_slow(addr, len, type);
+}
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  uint8_t *host = vaddr_to_host(addr, len, MEM_TYPE_IFETCH);
+  if (likely(host != NULL)) {
+    ifetch_window.page = addr & ~PAGE_MASK;
+    ifetch_window.host = host - (addr & PAGE_MASK);
+    return host_read(host, len);
+  }
+  return vaddr_load(addr, len, MEM_TYPE_IFETCH);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  return vaddr_load(addr, len, MEM_TYPE_READ);
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
-  paddr_write(addr, len, data);
+  if (isa_mmu_check(addr, len, MEM_TYPE_WRITE) != MMU_TRANSLATE) { paddr_write(addr, len, data); return; }
+  uint8_t *host = tlb_lookup(addr, len, MEM_TYPE_WRITE);
+  if (likely(host != NULL)) {
+    host_write(host, len, data);
+    // an aligned access inside a single page
+    IFDEF(CONFIG_PMEM_DIRTY, pmem_mark_dirty_host(host));
+    return;
+  }
+  vaddr_write_slow(addr, len, data);
+}
+
+uint8_t* vaddr_to_host(vaddr_t addr, int len, int type) {
+  uint8_t *host = NULL;
+  if (isa_mmu_check(addr, len, type) != MMU_TRANSLATE) {
+    if (in_pmem(addr) && !cross_page(addr, len)) host = guest_to_host(addr);
+  } else {
+    host = tlb_lookup(addr, len, type);
+    if (host == NULL && !cross_page(addr, len)) {
+      paddr_t paddr = vaddr_translate(addr, len, type);
+      if (in_pmem(paddr)) host = guest_to_host(paddr);
+    }
+  }
+  // the caller is going to write through `host'
+  IFDEF(CONFIG_PMEM_DIRTY, if (host != NULL && type == MEM_TYPE_WRITE) pmem_mark_dirty_host(host));
+  return host;
+}
+
+#ifdef CONFIG_PREDECODE
+void decode_cache_flush();
+void decode_cache_flush_page(vaddr_t page);
+
+void vaddr_mark_code(vaddr_t addr) {
+  if (isa_mmu_check(addr, 4, MEM_TYPE_IFETCH) != MMU_TRANSLATE) { paddr_mark_code(addr, addr); return; }
+  // searching the chunks of sparse pmem is slower than the page walk
+  uint8_t *host = MUXDEF(CONFIG_PMEM_SPARSE, NULL, tlb_lookup(addr, 1, MEM_TYPE_IFETCH));
+  paddr_mark_code(host != NULL ? host_to_guest(host) : vaddr_translate(addr, 1, MEM_TYPE_IFETCH), addr);
+}
+
+void tlb_protect_code(paddr_t page) {
+  uint8_t *host = guest_to_host(page);
+  int i;
+  for (i = 0; i < NR_TLB; i ++) {
+    TLBEntry *e = &tlb[i];
+    if ((uint8_t *)(uintptr_t)((vaddr_t)e->tag[MEM_TYPE_WRITE] + e->addend) == host) {
+      e->tag[MEM_TYPE_WRITE] = 0;
+    }
+  }
+}
+#endif
+
+void tlb_flush() {
+  memset(tlb, 0, sizeof(tlb));
+  ifetch_window.page = IFETCH_INVALID;
+  IFDEF(CONFIG_PREDECODE, decode_cache_flush());
+}
+
+void tlb_flush_page(vaddr_t addr) {
+  vaddr_t page = addr & ~PAGE_MASK;
+  TLBEntry *e = tlb_entry(page);
+  memset(e->tag, 0, sizeof(e->tag));
+  ifetch_window.page = IFETCH_INVALID;
+  IFDEF(CONFIG_PREDECODE, decode_cache_flush_page(page));
+}
+
+void tlb_switch_asid(int asid) {
+  tlb_ctx = TLB_VALID | ((uint64_t)asid << TLB_ASID_SHIFT);
+  ifetch_window.page = IFETCH_INVALID;
+  IFDEF(CONFIG_PREDECODE, decode_cache_flush());
 }
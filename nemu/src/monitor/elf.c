@@ -0,0 +1,193 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+/* Load an ELF image into pmem. With PMEM_MMAP, the whole pages of a
+ * segment are mapped copy-on-write from the file, and the whole pages of
+ * its .bss are mapped as anonymous memory which is zeroed by the host on
+ * demand. Partial pages are copied, so that the bytes of a page not
+ * covered by the segment are left untouched. With HOST_HUGEPAGE, all
+ * segments are copied instead, since mapping them would split the huge
+ * pages of pmem. The file stays mapped, and its symbol table is kept to
+ * look up functions by address.
+ */
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+#ifndef CONFIG_TARGET_AM
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef MUXDEF(CONFIG_ISA64, Elf64_Ehdr, Elf32_Ehdr) Elf_Ehdr;
+typedef MUXDEF(CONFIG_ISA64, Elf64_Phdr, Elf32_Phdr) Elf_Phdr;
+typedef MUXDEF(CONFIG_ISA64, Elf64_Shdr, Elf32_Shdr) Elf_Shdr;
+typedef MUXDEF(CONFIG_ISA64, Elf64_Sym, Elf32_Sym) Elf_Sym;
+#define ELF_CLASS MUXDEF(CONFIG_ISA64, ELFCLASS64, ELFCLASS32)
+#define ELF_ST_TYPE(info) ((info) & 0xf)
+
+#ifndef EM_LOONGARCH
+#define EM_LOONGARCH 258
+#endif
+#if defined(CONFIG_ISA_x86)
+#define ELF_MACHINE EM_386
+#elif defined(CONFIG_ISA_mips32)
+#define ELF_MACHINE EM_MIPS
+#elif defined(CONFIG_ISA_riscv)
+#define ELF_MACHINE EM_RISCV
+#else
+#define ELF_MACHINE EM_LOONGARCH
+#endif
+
+typedef struct {
+  vaddr_t addr;
+  word_t size;
+  const char *name;  // inside the mapped file
+} ElfFunc;
+
+static ElfFunc *funcs = NULL;
+static int nr_func = 0;
+
+bool is_elf(const char *file) {
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) return false;
+  char magic[SELFMAG];
+  bool ret = (fread(magic, SELFMAG, 1, fp) == 1 && memcmp(magic, ELFMAG, SELFMAG) == 0);
+  fclose(fp);
+  return ret;
+}
+
+// copy `len' bytes from `src' to pmem at `addr', or zeros if `src' is NULL
+static void copy_to_pmem(paddr_t addr, const uint8_t *src, size_t len) {
+  while (len > 0) {
+    size_t n = paddr_host_span(addr, len);
+    if (src == NULL) memset(guest_to_host(addr), 0, n);
+    else { memcpy(guest_to_host(addr), src, n); src += n; }
+    addr += n;
+    len -= n;
+  }
+}
+
+/* Map the whole pages of [addr, addr + len) from the file at `off', or
+ * anonymous zero pages if `fd' is -1. The parts in partial pages are
+ * copied from `src'. */
+static void load_range(paddr_t addr, const uint8_t *src, size_t len, int fd, off_t off) {
+#if defined(CONFIG_PMEM_MMAP) && !defined(CONFIG_HOST_HUGEPAGE)
+  paddr_t first = (addr + PAGE_MASK) & ~PAGE_MASK;
+  paddr_t last = (addr + len) & ~PAGE_MASK;
+  bool can_map = (fd == -1 || (addr - off) % PAGE_SIZE == 0);
+  if (can_map && first < last) {
+    copy_to_pmem(addr, src, first - addr);
+    int flags = MAP_PRIVATE | MAP_FIXED | (fd == -1 ? MAP_ANONYMOUS : 0);
+    void *p = mmap(guest_to_host(first), last - first, PROT_READ | PROT_WRITE, flags, fd,
+        fd == -1 ? 0 : off + (first - addr));
+    Assert(p != MAP_FAILED, "can not map the image at " FMT_PADDR, first);
+    copy_to_pmem(last, src == NULL ? NULL : src + (last - addr), addr + len - last);
+    return;
+  }
+#endif
+  copy_to_pmem(addr, src, len);
+}
+
+// check that [off, off + len) is inside a file of `size' bytes
+static bool in_file(uint64_t off, uint64_t len, uint64_t size) {
+  return off <= size && len <= size - off;
+}
+
+static void load_symbols(const uint8_t *buf, uint64_t size, const Elf_Ehdr *eh, const char *file) {
+  Assert(eh->e_shentsize == sizeof(Elf_Shdr) &&
+      in_file(eh->e_shoff, (uint64_t)eh->e_shnum * sizeof(Elf_Shdr), size),
+      "section headers of '%s' are out of the file", file);
+  const Elf_Shdr *sh = (const Elf_Shdr *)(buf + eh->e_shoff);
+  int i, j;
+  for (i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB) continue;
+    Assert(in_file(sh[i].sh_offset, sh[i].sh_size, size) && sh[i].sh_link < eh->e_shnum,
+        "symbol table of '%s' is out of the file", file);
+    const Elf_Shdr *str = &sh[sh[i].sh_link];
+    Assert(in_file(str->sh_offset, str->sh_size, size) && str->sh_size > 0 &&
+        buf[str->sh_offset + str->sh_size - 1] == '\0',
+        "string table of '%s' is out of the file", file);
+    const Elf_Sym *sym = (const Elf_Sym *)(buf + sh[i].sh_offset);
+    const char *strtab = (const char *)buf + str->sh_offset;
+    int nr_sym = sh[i].sh_size / sizeof(Elf_Sym);
+    funcs = realloc(funcs, (nr_func + nr_sym) * sizeof(ElfFunc));
+    assert(funcs);
+    for (j = 0; j < nr_sym; j ++) {
+      if (ELF_ST_TYPE(sym[j].st_info) != STT_FUNC) continue;
+      Assert(sym[j].st_name < str->sh_size, "symbol name of '%s' is out of the file", file);
+      funcs[nr_func ++] = (ElfFunc) {
+        .addr = sym[j].st_value, .size = sym[j].st_size, .name = strtab + sym[j].st_name };
+    }
+  }
+}
+
+const char *elf_func_name(vaddr_t addr) {
+  int i;
+  for (i = 0; i < nr_func; i ++) {
+    if (addr - funcs[i].addr < funcs[i].size) return funcs[i].name;
+  }
+  return NULL;
+}
+
+// return the size of the image from RESET_VECTOR, including .bss
+long load_elf(const char *file) {
+  int fd = open(file, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", file);
+  struct stat st;
+  Assert(fstat(fd, &st) == 0 && st.st_size >= sizeof(Elf_Ehdr), "'%s' is not a valid ELF file", file);
+  const uint8_t *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  Assert(buf != MAP_FAILED, "Can not map '%s'", file);
+
+  const Elf_Ehdr *eh = (const Elf_Ehdr *)buf;
+  Assert(eh->e_ident[EI_CLASS] == ELF_CLASS, "'%s' is not a %d-bit ELF file", file,
+      MUXDEF(CONFIG_ISA64, 64, 32));
+  Assert(eh->e_machine == ELF_MACHINE, "'%s' is not an ELF file of %s", file, str(__GUEST_ISA__));
+  if (eh->e_entry != RESET_VECTOR) {
+    Log("The entry " FMT_WORD " of '%s' is ignored, NEMU starts at " FMT_PADDR,
+        (word_t)eh->e_entry, file, RESET_VECTOR);
+  }
+
+  Assert(eh->e_phentsize == sizeof(Elf_Phdr) &&
+      in_file(eh->e_phoff, (uint64_t)eh->e_phnum * sizeof(Elf_Phdr), st.st_size),
+      "program headers of '%s' are out of the file", file);
+  const Elf_Phdr *ph = (const Elf_Phdr *)(buf + eh->e_phoff);
+  paddr_t end = RESET_VECTOR;
+  int i;
+  for (i = 0; i < eh->e_phnum; i ++) {
+    if (ph[i].p_type != PT_LOAD || ph[i].p_memsz == 0) continue;
+    Assert(ph[i].p_filesz <= ph[i].p_memsz && in_file(ph[i].p_offset, ph[i].p_filesz, st.st_size),
+        "segment %d of '%s' is out of the file", i, file);
+    paddr_t addr = ph[i].p_paddr;
+    Assert(in_pmem(addr) && in_pmem(addr + ph[i].p_memsz - 1),
+        "segment [" FMT_PADDR ", " FMT_PADDR ") of '%s' is out of pmem",
+        addr, (paddr_t)(addr + ph[i].p_memsz), file);
+    load_range(addr, buf + ph[i].p_offset, ph[i].p_filesz, fd, ph[i].p_offset);
+    load_range(addr + ph[i].p_filesz, NULL, ph[i].p_memsz - ph[i].p_filesz, -1, 0);
+    if (addr + ph[i].p_memsz > end) end = addr + ph[i].p_memsz;
+  }
+  if (eh->e_shoff != 0) load_symbols(buf, st.st_size, eh, file);
+  // the mappings of pmem hold their own references to the file
+  close(fd);
+
+  Log("The image is %s, ELF, size = %ld, %d function symbols", file,
+      (long)(end - RESET_VECTOR), nr_func);
+  return end - RESET_VECTOR;
+}
+#endif
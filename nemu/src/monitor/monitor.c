@@ -14,9 +14,12 @@
  ***************************************************************************************/
 
 #include <isa.h>
+#include <cpu/aot.h>
+#include <cpu/cpu.h>
 #include <memory/paddr.h>
 
 void init_rand();
+void init_icount(int shift);
 void init_log(const char* log_file);
 void init_mem();
 void init_difftest(char* ref_so_file, long img_size, int port);
@@ -46,6 +49,11 @@ static char* log_file = NULL;
 static char* diff_so_file = NULL;
 static char* img_file = NULL;
 static int difftest_port = 1234;
+static char* aot_so_file = NULL;
+static int icount_shift = -1;
+
+bool is_elf(const char* file);
+long load_elf(const char* file);
 
 static long load_img() {
     if (img_file == NULL) {
@@ -53,6 +61,10 @@ static long load_img() {
         return 4096;  // built-in image size
     }
 
+    if (is_elf(img_file)) {
+        return load_elf(img_file);
+    }
+
     FILE* fp = fopen(img_file, "rb");
     Assert(fp, "Can not open '%s'", img_file);
 
@@ -62,8 +74,16 @@ static long load_img() {
     Log("The image is %s, size = %ld", img_file, size);
 
     fseek(fp, 0, SEEK_SET);
-    int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
-    assert(ret == 1);
+    paddr_touch(RESET_VECTOR, size);
+    paddr_t addr = RESET_VECTOR;
+    long left = size;
+    while (left > 0) {
+        size_t n = paddr_host_span(addr, left);
+        int ret = fread(guest_to_host(addr), n, 1, fp);
+        assert(ret == 1);
+        addr += n;
+        left -= n;
+    }
 
     fclose(fp);
     return size;
@@ -75,11 +95,13 @@ static int parse_args(int argc, char* argv[]) {
         {"log", required_argument, NULL, 'l'},
         {"diff", required_argument, NULL, 'd'},
         {"port", required_argument, NULL, 'p'},
+        {"aot", required_argument, NULL, 'a'},
+        {"icount", required_argument, NULL, 'i'},
         {"help", no_argument, NULL, 'h'},
         {0, 0, NULL, 0},
     };
     int o;
-    while ((o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+    while ((o = getopt_long(argc, argv, "-bhl:d:p:a:i:", table, NULL)) != -1) {
         switch (o) {
             case 'b':
                 sdb_set_batch_mode();
@@ -93,6 +115,21 @@ static int parse_args(int argc, char* argv[]) {
             case 'd':
                 diff_so_file = optarg;
                 break;
+            case 'a':
+                aot_so_file = optarg;
+                break;
+            case 'i': {
+                char* end;
+                long shift = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || shift < 0 || shift > 10) {
+                    printf("Invalid SHIFT '%s' of --icount, it should be an "
+                           "integer in [0, 10]\n", optarg);
+                    printf("Usage: %s [OPTION...] IMAGE [args]\n", argv[0]);
+                    exit(1);
+                }
+                icount_shift = shift;
+                break;
+            }
             case 1:
                 img_file = optarg;
                 return 0;
@@ -104,6 +141,10 @@ static int parse_args(int argc, char* argv[]) {
                        "REF_SO\n");
                 printf(
                     "\t-p,--port=PORT          run DiffTest with port PORT\n");
+                printf("\t-a,--aot=AOT_SO         run blocks translated by "
+                       "tools/aot in AOT_SO\n");
+                printf("\t-i,--icount=SHIFT       use virtual time, 2^SHIFT ns "
+                       "per instruction\n");
                 printf("\n");
                 exit(0);
         }
@@ -117,12 +158,15 @@ void init_monitor(int argc, char* argv[]) {
     /* Parse arguments. */
     parse_args(argc, argv);
 
-    /* Set random seed. */
-    init_rand();
-
     /* Open the log file. */
     init_log(log_file);
 
+    /* Set the virtual time mode. */
+    init_icount(icount_shift);
+
+    /* Set random seed. */
+    init_rand();
+
     /* Initialize memory. */
     init_mem();
 
@@ -135,6 +179,18 @@ void init_monitor(int argc, char* argv[]) {
     /* Load the image to memory. This will overwrite the built-in image. */
     long img_size = load_img();
 
+    /* Load the blocks translated ahead of time. */
+#ifdef CONFIG_AOT
+    init_aot(aot_so_file);
+#else
+    if (aot_so_file != NULL) {
+        Log("CONFIG_AOT is disabled, ignore %s", aot_so_file);
+    }
+#endif
+
+    /* Start the other harts. */
+    IFDEF(CONFIG_MULTI_HART, init_harts());
+
     /* Initialize differential testing. */
     init_difftest(diff_so_file, img_size, difftest_port);
 
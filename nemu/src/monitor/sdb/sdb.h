@@ -25,6 +25,7 @@ void free_wp(WP* wp);
 WP* set_watchpoint(char* expr_str);
 bool delete_watchpoint(int num);
 void print_watchpoints();
+bool has_watchpoint();
 bool check_watchpoints();
 WP* get_wp(int num);
 
@@ -151,6 +151,9 @@ void print_watchpoints() {
     }
 }
 
+// Return true if any watchpoint is set
+bool has_watchpoint() { return head != NULL; }
+
 // Check if any watchpoint has been triggered
 // Returns true if program should be stopped
 bool check_watchpoints() {
@@ -22,6 +22,8 @@ IFDEF(CONFIG_TIMER_CLOCK_GETTIME,
     static_assert(sizeof(clock_t) == 8, "sizeof(clock_t) != 8"));
 
 static uint64_t boot_time = 0;
+int g_icount_shift = -1;
+extern uint64_t g_nr_guest_inst;
 
 static uint64_t get_time_internal() {
 #if defined(CONFIG_TARGET_AM)
@@ -44,6 +46,21 @@ uint64_t get_time() {
   return now - boot_time;
 }
 
+// In the icount mode, the guest time only depends on the number of
+// instructions executed, each of which takes 2^shift ns.
+void init_icount(int shift) {
+  if (shift < 0) return;
+  Assert(shift <= 10, "icount shift should be in [0, 10], but got %d", shift);
+  g_icount_shift = shift;
+  Log("Virtual time: %d ns per instruction", 1 << shift);
+}
+
+uint64_t get_guest_time() {
+  if (g_icount_shift < 0) return get_time();
+  return (g_nr_guest_inst << g_icount_shift) / 1000;
+}
+
 void init_rand() {
-  srand(get_time_internal());
+  // make the runs in the icount mode reproducible
+  srand(g_icount_shift >= 0 ? 0 : get_time_internal());
 }
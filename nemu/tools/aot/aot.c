@@ -0,0 +1,341 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Translate a riscv32 ELF image into C code ahead of time.
+ *
+ * Basic blocks are discovered from the entry point and the function
+ * symbols by following the control flow: targets and fall-through of
+ * branches, targets of jal, and return sites of calls. Targets of other
+ * indirect jumps are not known, and NEMU interprets them instead.
+ *
+ * Each block becomes a C function against <cpu/aot-abi.h>, and a table
+ * of all blocks is exported as `aot_blocks'. A block ends at a control
+ * transfer, before an instruction which is not supported (e.g. system
+ * instructions, which are left to NEMU), or before another block.
+ *
+ * Usage: aot IMAGE.elf > IMAGE-aot.c
+ *        cc -O2 -shared -fPIC -I$NEMU_HOME/include IMAGE-aot.c -o IMAGE-aot.so
+ *        riscv32-nemu-interpreter --aot=IMAGE-aot.so IMAGE.bin
+ */
+
+#include <cpu/aot-abi.h>
+#include <elf.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_TEXT 16
+#define MAX_BLOCK_INST 256
+
+#define BITS(x, hi, lo) (((x) >> (lo)) & ((1u << ((hi) - (lo) + 1)) - 1))
+
+enum { INST_NORMAL, INST_BRANCH, INST_JAL, INST_JALR, INST_UNSUPPORTED };
+
+typedef struct {
+  uint32_t addr, size;
+  const uint8_t *data;
+} Text;
+
+static Text text[MAX_TEXT];
+static int nr_text = 0;
+static uint32_t text_lo = UINT32_MAX, text_hi = 0;
+static uint8_t *leader = NULL, *visited = NULL;  // indexed by (pc - text_lo) / 4
+static uint32_t *worklist = NULL;
+static int nr_work = 0;
+
+static void error(const char *msg) {
+  fprintf(stderr, "aot: %s\n", msg);
+  exit(1);
+}
+
+static uint8_t *read_file(const char *path, long *size) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) { perror(path); exit(1); }
+  fseek(fp, 0, SEEK_END);
+  *size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  uint8_t *buf = malloc(*size);
+  if (fread(buf, *size, 1, fp) != 1) { perror(path); exit(1); }
+  fclose(fp);
+  return buf;
+}
+
+static bool fetch(uint32_t pc, uint32_t *inst) {
+  int i;
+  for (i = 0; i < nr_text; i ++) {
+    if (text[i].size >= 4 && pc - text[i].addr <= text[i].size - 4) {
+      memcpy(inst, text[i].data + (pc - text[i].addr), 4);
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline uint32_t text_idx(uint32_t pc) { return (pc - text_lo) / 4; }
+
+static void add_leader(uint32_t pc) {
+  uint32_t inst;
+  if ((pc & 3) != 0 || !fetch(pc, &inst)) return;
+  if (!leader[text_idx(pc)]) {
+    leader[text_idx(pc)] = 1;
+    worklist[nr_work ++] = pc;
+  }
+}
+
+static void load_elf(const uint8_t *buf, long size) {
+  const Elf32_Ehdr *eh = (const void *)buf;
+  if (size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0) error("not an ELF file");
+  if (eh->e_ident[EI_CLASS] != ELFCLASS32 || eh->e_ident[EI_DATA] != ELFDATA2LSB ||
+      eh->e_machine != EM_RISCV) {
+    error("only little-endian riscv32 ELF files are supported");
+  }
+  if (eh->e_shoff + (long)eh->e_shnum * sizeof(Elf32_Shdr) > size) error("truncated section headers");
+  const Elf32_Shdr *sh = (const void *)(buf + eh->e_shoff);
+
+  int i;
+  for (i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_PROGBITS || !(sh[i].sh_flags & SHF_EXECINSTR) || sh[i].sh_size == 0) continue;
+    if (nr_text == MAX_TEXT) error("too many text sections");
+    if (sh[i].sh_offset + (long)sh[i].sh_size > size) error("truncated text section");
+    text[nr_text ++] = (Text) { sh[i].sh_addr, sh[i].sh_size, buf + sh[i].sh_offset };
+    if (sh[i].sh_addr < text_lo) text_lo = sh[i].sh_addr;
+    if (sh[i].sh_addr + sh[i].sh_size > text_hi) text_hi = sh[i].sh_addr + sh[i].sh_size;
+  }
+  if (nr_text == 0) error("no text section");
+
+  uint32_t nr_word = (text_hi - text_lo) / 4 + 1;
+  leader = calloc(nr_word, 1);
+  visited = calloc(nr_word, 1);
+  worklist = malloc(nr_word * sizeof(uint32_t));
+
+  add_leader(eh->e_entry);
+  for (i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB) continue;
+    const Elf32_Sym *sym = (const void *)(buf + sh[i].sh_offset);
+    int j, n = sh[i].sh_size / sizeof(Elf32_Sym);
+    for (j = 0; j < n; j ++) {
+      if (ELF32_ST_TYPE(sym[j].st_info) == STT_FUNC) add_leader(sym[j].st_value);
+    }
+  }
+}
+
+static int classify(uint32_t inst) {
+  int funct3 = BITS(inst, 14, 12), funct7 = BITS(inst, 31, 25);
+  switch (BITS(inst, 6, 0)) {
+    case 0x37: case 0x17: return INST_NORMAL;
+    case 0x03: return (funct3 == 3 || funct3 > 5) ? INST_UNSUPPORTED : INST_NORMAL;
+    case 0x23: return funct3 > 2 ? INST_UNSUPPORTED : INST_NORMAL;
+    case 0x13:
+      if (funct3 == 1 && funct7 != 0) return INST_UNSUPPORTED;
+      if (funct3 == 5 && (funct7 & ~0x20) != 0) return INST_UNSUPPORTED;
+      return INST_NORMAL;
+    case 0x33:
+      if (funct7 == 0x20) return (funct3 == 0 || funct3 == 5) ? INST_NORMAL : INST_UNSUPPORTED;
+      return (funct7 == 0 || funct7 == 1) ? INST_NORMAL : INST_UNSUPPORTED;
+    case 0x63: return (funct3 == 2 || funct3 == 3) ? INST_UNSUPPORTED : INST_BRANCH;
+    case 0x6f: return INST_JAL;
+    case 0x67: return funct3 == 0 ? INST_JALR : INST_UNSUPPORTED;
+    default: return INST_UNSUPPORTED;
+  }
+}
+
+static uint32_t imm_i(uint32_t inst) { return (int32_t)inst >> 20; }
+static uint32_t imm_s(uint32_t inst) { return ((int32_t)inst >> 25 << 5) | BITS(inst, 11, 7); }
+static uint32_t imm_b(uint32_t inst) {
+  return ((int32_t)inst >> 31 << 12) | (BITS(inst, 7, 7) << 11) | (BITS(inst, 30, 25) << 5) | (BITS(inst, 11, 8) << 1);
+}
+static uint32_t imm_j(uint32_t inst) {
+  return ((int32_t)inst >> 31 << 20) | (BITS(inst, 19, 12) << 12) | (BITS(inst, 20, 20) << 11) | (BITS(inst, 30, 21) << 1);
+}
+
+// follow the control flow from all leaders to find reachable code
+static void discover() {
+  while (nr_work > 0) {
+    uint32_t pc = worklist[-- nr_work], inst;
+    while (!visited[text_idx(pc)]) {
+      visited[text_idx(pc)] = 1;
+      fetch(pc, &inst);
+      int kind = classify(inst);
+      int rd = BITS(inst, 11, 7);
+      if (kind == INST_BRANCH) {
+        add_leader(pc + imm_b(inst));
+        add_leader(pc + 4);
+        break;
+      } else if (kind == INST_JAL) {
+        add_leader(pc + imm_j(inst));
+        if (rd != 0) add_leader(pc + 4);
+        break;
+      } else if (kind == INST_JALR) {
+        if (rd != 0) add_leader(pc + 4);
+        break;
+      } else if (kind == INST_UNSUPPORTED) {
+        // e.g. ecall, which may return to the next instruction
+        add_leader(pc + 4);
+        break;
+      }
+      pc += 4;
+      if (!fetch(pc, &inst) || leader[text_idx(pc)]) break;
+    }
+  }
+}
+
+// emit the `idx'-th instruction of a block, return its kind
+static int emit_inst(uint32_t pc, uint32_t inst, int idx) {
+  int kind = classify(inst);
+  if (kind == INST_UNSUPPORTED) return kind;
+  int rd = BITS(inst, 11, 7), rs1 = BITS(inst, 19, 15), rs2 = BITS(inst, 24, 20);
+  int funct3 = BITS(inst, 14, 12), funct7 = BITS(inst, 31, 25);
+  uint32_t imm = imm_i(inst);
+  int opcode = BITS(inst, 6, 0);
+  char dst[16];
+  // writes to $zero are dropped, but loads may still have side effects
+  if (rd == 0) strcpy(dst, "(void)");
+  else snprintf(dst, sizeof(dst), "r[%d] = ", rd);
+
+  printf("  // %08x: %08x\n", pc, inst);
+  if (rd == 0 && (opcode == 0x37 || opcode == 0x17 || opcode == 0x13 || opcode == 0x33)) return kind;
+  switch (opcode) {
+    case 0x37: printf("  %s0x%08xu;\n", dst, inst & 0xfffff000u); break;
+    case 0x17: printf("  %s0x%08xu;\n", dst, pc + (inst & 0xfffff000u)); break;
+    case 0x03: {
+      static const char *cast[] = { "(int8_t)", "(int16_t)", "", "", "", "" };
+      printf("  %s(uint32_t)%saot_read(h, r[%d] + 0x%xu, %d);\n",
+          dst, cast[funct3], rs1, imm, 1 << (funct3 & 3));
+      break;
+    }
+    case 0x23:
+      printf("  if (aot_write(h, r[%d] + 0x%xu, %d, r[%d])) { s->pc = 0x%08xu; return %d; }\n",
+          rs1, imm_s(inst), 1 << funct3, rs2, pc + 4, idx + 1);
+      break;
+    case 0x13: {
+      static const char *fmt[] = {
+        "r[%d] + 0x%xu", "r[%d] << %u", "(int32_t)r[%d] < (int32_t)0x%xu", "r[%d] < 0x%xu",
+        "r[%d] ^ 0x%xu", "r[%d] >> %u", "r[%d] | 0x%xu", "r[%d] & 0x%xu",
+      };
+      printf("  %s", dst);
+      if (funct3 == 5 && funct7 != 0) printf("(uint32_t)((int32_t)r[%d] >> %u)", rs1, imm & 0x1f);
+      else printf(fmt[funct3], rs1, (funct3 == 1 || funct3 == 5) ? imm & 0x1f : imm);
+      printf(";\n");
+      break;
+    }
+    case 0x33: {
+      static const char *base[] = {
+        "r[%d] + r[%d]", "r[%d] << (r[%d] & 0x1f)", "(int32_t)r[%d] < (int32_t)r[%d]", "r[%d] < r[%d]",
+        "r[%d] ^ r[%d]", "r[%d] >> (r[%d] & 0x1f)", "r[%d] | r[%d]", "r[%d] & r[%d]",
+      };
+      static const char *mext[] = {
+        "r[%d] * r[%d]",
+        "(uint32_t)(((int64_t)(int32_t)r[%d] * (int64_t)(int32_t)r[%d]) >> 32)",
+        "(uint32_t)(((int64_t)(int32_t)r[%d] * (uint64_t)r[%d]) >> 32)",
+        "(uint32_t)(((uint64_t)r[%d] * (uint64_t)r[%d]) >> 32)",
+        "aot_div(r[%d], r[%d])", "aot_divu(r[%d], r[%d])", "aot_rem(r[%d], r[%d])", "aot_remu(r[%d], r[%d])",
+      };
+      printf("  %s", dst);
+      if (funct7 == 1) printf(mext[funct3], rs1, rs2);
+      else if (funct7 == 0x20 && funct3 == 0) printf("r[%d] - r[%d]", rs1, rs2);
+      else if (funct7 == 0x20) printf("(uint32_t)((int32_t)r[%d] >> (r[%d] & 0x1f))", rs1, rs2);
+      else printf(base[funct3], rs1, rs2);
+      printf(";\n");
+      break;
+    }
+    case 0x63: {
+      static const char *cond[] = {
+        "r[%d] == r[%d]", "r[%d] != r[%d]", "", "",
+        "(int32_t)r[%d] < (int32_t)r[%d]", "(int32_t)r[%d] >= (int32_t)r[%d]", "r[%d] < r[%d]", "r[%d] >= r[%d]",
+      };
+      printf("  if (");
+      printf(cond[funct3], rs1, rs2);
+      printf(") { s->pc = 0x%08xu; return %d; }\n", pc + imm_b(inst), idx + 1);
+      break;
+    }
+    case 0x6f:
+      if (rd != 0) printf("  r[%d] = 0x%08xu;\n", rd, pc + 4);
+      printf("  s->pc = 0x%08xu; return %d;\n", pc + imm_j(inst), idx + 1);
+      break;
+    case 0x67:
+      printf("  { uint32_t t = (r[%d] + 0x%xu) & ~1u;", rs1, imm);
+      if (rd != 0) printf(" r[%d] = 0x%08xu;", rd, pc + 4);
+      printf(" s->pc = t; return %d; }\n", idx + 1);
+      break;
+  }
+  return kind;
+}
+
+static const char *prelude =
+  "#include <cpu/aot-abi.h>\n\n"
+  "static inline uint32_t aot_div(uint32_t a, uint32_t b) {\n"
+  "  return b == 0 ? UINT32_MAX : ((int32_t)a == INT32_MIN && (int32_t)b == -1) ? a : (uint32_t)((int32_t)a / (int32_t)b);\n"
+  "}\n"
+  "static inline uint32_t aot_divu(uint32_t a, uint32_t b) { return b == 0 ? UINT32_MAX : a / b; }\n"
+  "static inline uint32_t aot_rem(uint32_t a, uint32_t b) {\n"
+  "  return b == 0 ? a : ((int32_t)a == INT32_MIN && (int32_t)b == -1) ? 0 : (uint32_t)((int32_t)a % (int32_t)b);\n"
+  "}\n"
+  "static inline uint32_t aot_remu(uint32_t a, uint32_t b) { return b == 0 ? a : a % b; }\n";
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s IMAGE.elf > IMAGE-aot.c\n", argv[0]);
+    return 1;
+  }
+  long size;
+  uint8_t *buf = read_file(argv[1], &size);
+  load_elf(buf, size);
+  discover();
+
+  uint32_t *block_pc = malloc(sizeof(uint32_t) * ((text_hi - text_lo) / 4 + 1));
+  uint32_t *block_len = malloc(sizeof(uint32_t) * ((text_hi - text_lo) / 4 + 1));
+  uint32_t *block_hash = malloc(sizeof(uint32_t) * ((text_hi - text_lo) / 4 + 1));
+  int nr_block = 0, nr_inst = 0;
+
+  printf("/* Generated by tools/aot from %s. DO NOT EDIT. */\n\n%s", argv[1], prelude);
+  uint32_t pc;
+  for (pc = text_lo; pc < text_hi; pc += 4) {
+    if (!leader[text_idx(pc)] || !visited[text_idx(pc)]) continue;
+    uint32_t insts[MAX_BLOCK_INST], inst;
+    int n = 0;
+    uint32_t p;
+    for (p = pc; n < MAX_BLOCK_INST && fetch(p, &inst); p += 4) {
+      if (p != pc && leader[text_idx(p)]) break;
+      int kind = classify(inst);
+      if (kind == INST_UNSUPPORTED) break;
+      insts[n ++] = inst;
+      if (kind != INST_NORMAL) break;
+    }
+    if (n == 0) continue;
+
+    printf("\nstatic int aot_%08x(AOTState *s, const AOTHost *h) {\n", pc);
+    printf("  uint32_t *r = s->gpr;\n");
+    int i, kind = INST_NORMAL;
+    for (i = 0; i < n; i ++) kind = emit_inst(pc + i * 4, insts[i], i);
+    if (kind == INST_NORMAL || kind == INST_BRANCH) printf("  s->pc = 0x%08xu; return %d;\n", pc + n * 4, n);
+    printf("}\n");
+
+    block_pc[nr_block] = pc;
+    block_len[nr_block] = n;
+    block_hash[nr_block] = aot_hash(insts, n);
+    nr_block ++;
+    nr_inst += n;
+  }
+
+  printf("\nconst AOTBlock aot_blocks[] = {\n");
+  int i;
+  for (i = 0; i < nr_block; i ++) {
+    printf("  { 0x%08xu, %u, 0x%08xu, aot_%08x },\n", block_pc[i], block_len[i], block_hash[i], block_pc[i]);
+  }
+  printf("};\n\nconst int aot_nr_block = %d;\n", nr_block);
+  printf("const int aot_abi_version = AOT_ABI_VERSION;\n");
+  fprintf(stderr, "aot: %d blocks, %d instructions\n", nr_block, nr_inst);
+  return 0;
+}
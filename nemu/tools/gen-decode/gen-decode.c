@@ -0,0 +1,287 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Read the INSTPAT table of an `inst.c' and generate a decode tree, i.e.
+ * nested switches on the bit fields fixed by the patterns, which maps an
+ * instruction to the index of the pattern it matches in O(1).
+ *
+ * The tree does not depend on the order of the patterns, so patterns
+ * must not overlap. The only exception is a catch-all pattern (all bits
+ * are '?') at the end of the table, which becomes the default result.
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#define MAX_PAT 1024
+#define MAX_NAME 32
+// the widest field to switch on in a single level
+#define MAX_FIELD_BITS 12
+
+typedef struct {
+  uint64_t key, mask;
+  int idx, line;
+  char name[MAX_NAME];
+} Pattern;
+
+static Pattern pats[MAX_PAT];
+static int nr_pat = 0;
+static int default_idx = -1;
+static const char *src_file = NULL;
+
+static void error(int line, const char *msg, const char *arg) {
+  fprintf(stderr, "%s:%d: error: %s%s\n", src_file, line, msg, arg ? arg : "");
+  exit(1);
+}
+
+static char *read_file(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) { perror(path); exit(1); }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char *buf = malloc(size + 1);
+  if (fread(buf, size, 1, fp) != 1 && size != 0) { perror(path); exit(1); }
+  buf[size] = '\0';
+  fclose(fp);
+  return buf;
+}
+
+// replace comments with spaces, but keep newlines to report correct line numbers
+static void strip_comments(char *p) {
+  bool in_str = false;
+  for (; *p != '\0'; p ++) {
+    if (in_str) {
+      if (*p == '\\' && p[1] != '\0') p ++;
+      else if (*p == '"') in_str = false;
+    } else if (*p == '"') {
+      in_str = true;
+    } else if (p[0] == '/' && p[1] == '/') {
+      while (*p != '\0' && *p != '\n') *p ++ = ' ';
+      if (*p == '\0') return;
+    } else if (p[0] == '/' && p[1] == '*') {
+      p[0] = p[1] = ' ';
+      for (p += 2; *p != '\0' && !(p[0] == '*' && p[1] == '/'); p ++) {
+        if (*p != '\n') *p = ' ';
+      }
+      if (*p == '\0') return;
+      p[0] = p[1] = ' ';
+      p ++;
+    }
+  }
+}
+
+static int line_of(const char *buf, const char *p) {
+  int line = 1;
+  for (; buf < p; buf ++) line += (*buf == '\n');
+  return line;
+}
+
+static bool is_ident(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+// find the next token `tok' which is not a part of a longer identifier
+static char *find_token(char *p, const char *tok) {
+  int len = strlen(tok);
+  while ((p = strstr(p, tok)) != NULL) {
+    bool left = (p[-1] == '\0') || !is_ident(p[-1]);
+    if (left && !is_ident(p[len])) return p;
+    p += len;
+  }
+  return NULL;
+}
+
+static char *skip_space(char *p) {
+  while (isspace((unsigned char)*p)) p ++;
+  return p;
+}
+
+static void parse_pattern(const char *buf, char *p) {
+  int line = line_of(buf, p);
+  if (nr_pat >= MAX_PAT) error(line, "too many patterns", NULL);
+  if (default_idx != -1) error(line, "pattern after the catch-all pattern is unreachable", NULL);
+
+  p = skip_space(p + strlen("INSTPAT"));
+  if (*p != '(') error(line, "expect '(' after INSTPAT", NULL);
+  p = skip_space(p + 1);
+  if (*p != '"') error(line, "expect a string literal as the pattern", NULL);
+
+  Pattern *pat = &pats[nr_pat];
+  pat->key = pat->mask = 0;
+  pat->idx = nr_pat;
+  pat->line = line;
+  int nbit = 0;
+  for (p ++; *p != '"'; p ++) {
+    switch (*p) {
+      case ' ': continue;
+      case '0': case '1': case '?':
+        pat->key = (pat->key << 1) | (*p == '1');
+        pat->mask = (pat->mask << 1) | (*p != '?');
+        nbit ++;
+        break;
+      default: error(line, "invalid character in pattern string", NULL);
+    }
+  }
+  if (nbit > 64) error(line, "pattern too long", NULL);
+
+  p = skip_space(p + 1);
+  if (*p != ',') error(line, "expect the name of the pattern", NULL);
+  p = skip_space(p + 1);
+  int i;
+  for (i = 0; i < MAX_NAME - 1 && *p != ',' && *p != ')' && !isspace((unsigned char)*p); i ++, p ++) {
+    pat->name[i] = *p;
+  }
+  pat->name[i] = '\0';
+
+  if (pat->mask == 0) default_idx = nr_pat;
+  nr_pat ++;
+}
+
+static void parse(char *buf) {
+  char *start = find_token(buf, "INSTPAT_START");
+  if (start == NULL) error(1, "can not find INSTPAT_START", NULL);
+  char *end = find_token(start, "INSTPAT_END");
+  if (end == NULL) error(line_of(buf, start), "can not find INSTPAT_END", NULL);
+  if (find_token(end, "INSTPAT_START") != NULL) {
+    error(line_of(buf, end), "only one INSTPAT table is supported", NULL);
+  }
+
+  // the pattern index is the order of appearance, which will be
+  // broken if some patterns are removed by the preprocessor
+  char *p;
+  for (p = start; p < end; p ++) {
+    if (*p == '\n' && *skip_space(p + 1) == '#') {
+      error(line_of(buf, p + 1), "preprocessor directives are not allowed inside the INSTPAT table", NULL);
+    }
+  }
+
+  *end = '\0';
+  p = start + strlen("INSTPAT_START");
+  while ((p = find_token(p, "INSTPAT")) != NULL) {
+    parse_pattern(buf, p);
+    p += strlen("INSTPAT");
+  }
+}
+
+static void check_overlap() {
+  int i, j;
+  for (i = 0; i < nr_pat; i ++) {
+    if (i == default_idx) continue;
+    for (j = i + 1; j < nr_pat; j ++) {
+      if (j == default_idx) continue;
+      uint64_t common = pats[i].mask & pats[j].mask;
+      if (((pats[i].key ^ pats[j].key) & common) == 0) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "pattern '%s' overlaps with pattern '%s' at line ",
+            pats[j].name, pats[i].name);
+        char arg[16];
+        snprintf(arg, sizeof(arg), "%d", pats[i].line);
+        error(pats[j].line, msg, arg);
+      }
+    }
+  }
+}
+
+static void indent(int level) { printf("%*s", level * 2, ""); }
+
+static void emit_leaf(Pattern **set, int n, uint64_t tested, int level) {
+  int i;
+  for (i = 0; i < n; i ++) {
+    uint64_t mask = set[i]->mask & ~tested;
+    if (mask == 0) {
+      indent(level); printf("return %d; // %s\n", set[i]->idx, set[i]->name);
+      return;
+    }
+    indent(level);
+    printf("if ((inst & 0x%" PRIx64 "ull) == 0x%" PRIx64 "ull) return %d; // %s\n",
+        mask, set[i]->key & mask, set[i]->idx, set[i]->name);
+  }
+  indent(level); printf("return %d;\n", default_idx);
+}
+
+static void emit_node(Pattern **set, int n, uint64_t tested, int level) {
+  uint64_t common = ~tested;
+  int i;
+  for (i = 0; i < n; i ++) common &= set[i]->mask;
+
+  if (n <= 1 || common == 0) {
+    emit_leaf(set, n, tested, level);
+    return;
+  }
+
+  // switch on the lowest run of bits fixed by all patterns in this node
+  int lo = __builtin_ctzll(common), hi = lo;
+  while (hi + 1 < 64 && hi - lo + 1 < MAX_FIELD_BITS && (common >> (hi + 1)) & 1) hi ++;
+  uint64_t fmask = (hi - lo == 63 ? ~0ull : ((1ull << (hi - lo + 1)) - 1));
+  uint64_t field = fmask << lo;
+
+  indent(level); printf("switch ((inst >> %d) & 0x%" PRIx64 ") {\n", lo, fmask);
+  Pattern **sub = malloc(sizeof(Pattern *) * n);
+  bool *done = calloc(n, sizeof(bool));
+  for (i = 0; i < n; i ++) {
+    if (done[i]) continue;
+    uint64_t val = (set[i]->key >> lo) & fmask;
+    int j, m = 0;
+    for (j = i; j < n; j ++) {
+      if (!done[j] && ((set[j]->key >> lo) & fmask) == val) {
+        sub[m ++] = set[j];
+        done[j] = true;
+      }
+    }
+    indent(level + 1); printf("case 0x%" PRIx64 ":\n", val);
+    emit_node(sub, m, tested | field, level + 2);
+  }
+  indent(level + 1); printf("default: return %d;\n", default_idx);
+  indent(level); printf("}\n");
+  free(sub);
+  free(done);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s inst.c\n", argv[0]);
+    return 1;
+  }
+  src_file = argv[1];
+  char *buf = read_file(src_file);
+  strip_comments(buf);
+  // make `p[-1]' valid for the first character
+  char *text = malloc(strlen(buf) + 2);
+  text[0] = '\0';
+  strcpy(text + 1, buf);
+  parse(text + 1);
+  check_overlap();
+
+  Pattern **set = malloc(sizeof(Pattern *) * (nr_pat + 1));
+  int i, n = 0;
+  for (i = 0; i < nr_pat; i ++) {
+    if (i != default_idx) set[n ++] = &pats[i];
+  }
+
+  printf("/* Generated by tools/gen-decode from %s. DO NOT EDIT. */\n\n", src_file);
+  printf("#ifndef __GENERATED_DECODE_TREE_H__\n");
+  printf("#define __GENERATED_DECODE_TREE_H__\n\n");
+  printf("#include <stdint.h>\n\n");
+  printf("#define DECODE_TREE_NR_PAT %d\n\n", nr_pat);
+  printf("// return the index of the INSTPAT matching `inst', or -1 if none\n");
+  printf("static inline int decode_tree(uint64_t inst) {\n");
+  emit_node(set, n, 0, 1);
+  printf("}\n\n#endif\n");
+  return 0;
+}
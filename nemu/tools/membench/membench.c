@@ -0,0 +1,142 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+/* Measure how the backing page size of a large area affects the kind of
+ * accesses NEMU makes to pmem: sequential reads (memory bandwidth) and
+ * dependent random loads (host TLB reach). The same area is measured with
+ * 4 KiB pages and with transparent huge pages, as with CONFIG_HOST_HUGEPAGE.
+ * The cost of marking dirty pages on each store and of fetching the flags,
+ * as with CONFIG_PMEM_DIRTY, is measured as well.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE_SIZE (2ul * 1024 * 1024)
+#define NR_CHASE (16 * 1024 * 1024)
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t *alloc_area(size_t size, int advice) {
+  uint8_t *raw = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) { perror("mmap"); exit(1); }
+  uint8_t *p = (uint8_t *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+  if (madvise(p, size, advice) != 0) perror("madvise");
+  memset(p, 0, size);
+  return (uint64_t *)p;
+}
+
+// link all words into a single random cycle, so every load depends on the last one
+static void build_chain(uint64_t *a, size_t n) {
+  uint64_t *perm = malloc(n * sizeof(uint64_t));
+  if (perm == NULL) { perror("malloc"); exit(1); }
+  size_t i;
+  for (i = 0; i < n; i ++) perm[i] = i;
+  for (i = n - 1; i > 0; i --) {
+    size_t j = ((uint64_t)rand() << 31 | rand()) % i;
+    uint64_t t = perm[i]; perm[i] = perm[j]; perm[j] = t;
+  }
+  for (i = 0; i < n; i ++) a[perm[i]] = perm[(i + 1) % n];
+  free(perm);
+}
+
+static void bench(const char *name, size_t size, int advice) {
+  uint64_t *a = alloc_area(size, advice);
+  size_t n = size / sizeof(uint64_t), i;
+  int round;
+
+  double t0 = now();
+  uint64_t sum = 0;
+  for (round = 0; round < 4; round ++) {
+    for (i = 0; i < n; i ++) sum += a[i];
+  }
+  double seq = now() - t0;
+
+  build_chain(a, n);
+  t0 = now();
+  uint64_t cur = 0;
+  for (i = 0; i < NR_CHASE; i ++) cur = a[cur];
+  double chase = now() - t0;
+
+  printf("%-6s sequential read %7.2f GiB/s, random load %6.2f ns  (%lu)\n", name,
+      4.0 * size / seq / (1ul << 30), chase * 1e9 / NR_CHASE, (unsigned long)(sum + cur));
+  munmap(a, size);
+}
+
+static uint64_t xorshift(uint64_t x) { x ^= x << 13; x ^= x >> 7; x ^= x << 17; return x; }
+
+// random stores over the area, with and without a flag store per page
+static void bench_dirty(size_t size) {
+  uint64_t *a = alloc_area(size, MADV_NOHUGEPAGE);
+  size_t n = size / sizeof(uint64_t), nr_page = size >> 12, i;
+  uint8_t *dirty = calloc(nr_page, 1);
+  uint64_t r = 1;
+  int mark;
+  double t[2];
+  for (mark = 0; mark < 2; mark ++) {
+    double t0 = now();
+    for (i = 0; i < NR_CHASE; i ++) {
+      r = xorshift(r);
+      size_t idx = r % n;
+      a[idx] = r;
+      if (mark) dirty[(idx * sizeof(uint64_t)) >> 12] = 1;
+    }
+    t[mark] = now() - t0;
+  }
+
+  // fetch and clear, the same loop as paddr_dirty_fetch_and_clear()
+  memset(dirty, 0, nr_page);
+  for (i = 0; i < nr_page; i += 97) dirty[i] = 1;
+  uint64_t *bitmap = calloc((nr_page + 63) / 64, sizeof(uint64_t));
+  int nr_dirty = 0;
+  double t0 = now();
+  for (i = 0; i < nr_page; i += 8) {
+    uint64_t flags;
+    memcpy(&flags, &dirty[i], 8);
+    if (flags == 0) continue;
+    size_t j;
+    for (j = i; j < i + 8; j ++) {
+      if (dirty[j]) { bitmap[j / 64] |= 1ull << (j % 64); nr_dirty ++; }
+    }
+    memset(&dirty[i], 0, 8);
+  }
+  double scan = now() - t0;
+
+  printf("dirty  store %.2f ns, store + mark %.2f ns, fetch %zu flags (%d dirty) %.1f us\n",
+      t[0] * 1e9 / NR_CHASE, t[1] * 1e9 / NR_CHASE, nr_page, nr_dirty, scan * 1e6);
+  free(bitmap);
+  free(dirty);
+  munmap(a, size);
+}
+
+int main(int argc, char *argv[]) {
+  size_t mb = (argc > 1 ? atoi(argv[1]) : 128);
+  size_t size = mb << 20;
+  printf("area = %zu MiB\n", mb);
+  bench("4 KiB", size, MADV_NOHUGEPAGE);
+  bench("2 MiB", size, MADV_HUGEPAGE);
+  bench_dirty(size);
+  return 0;
+}